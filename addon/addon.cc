@@ -1,67 +1,41 @@
+#include <algorithm>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
-#include <stack>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <napi.h>
 
-#include <base/files/file_util.h>
-#include <base/logging.h>
-#include <gn/command_format.h>
-#include <gn/filesystem_utils.h>
 #include <gn/functions.h>
-#include <gn/input_file.h>
-#include <gn/location.h>
-#include <gn/parse_tree.h>
-#include <gn/parser.h>
-#include <gn/token.h>
-#include <gn/tokenizer.h>
 #include <gn/variables.h>
 
-struct GNContext {
-  const base::FilePath* root = nullptr;
-  const Token* token = nullptr;
-  const FunctionCallNode* function = nullptr;
-  const IdentifierNode* variable = nullptr;
-};
-
-enum class GNSymbolKind : std::uint8_t {
-  Unknown = 0,
-  Function = 12,
-  Variable = 13,
-  Boolean = 17,
-  Operator = 25,
-};
-
-struct GNDocumentSymbol {
-  GNSymbolKind kind = GNSymbolKind::Unknown;
-  LocationRange range;
-  std::string name;
-  LocationRange selection_range;
-  std::list<GNDocumentSymbol> children;
-};
+#include "core.h"
 
-struct GNScope {
-  std::vector<const FunctionCallNode*> declares;
-  std::list<GNDocumentSymbol> symbols;
-};
-
-template <typename T>
-static auto JSValue(Napi::Env env,
-                    const std::vector<T>& vector) -> Napi::Value {
-  auto result = Napi::Array::New(env);
-  for (const auto& item : vector) {
-    result[result.Length()] = JSValue(env, item);
+static auto ToEdits(const Napi::Array& array) -> std::vector<GNEdit> {
+  std::vector<GNEdit> result;
+  auto position = [](const Napi::Object& object) {
+    return GNPosition{object.Get("line").As<Napi::Number>(),
+                      object.Get("column").As<Napi::Number>()};
+  };
+  for (uint32_t i = 0; i < array.Length(); i++) {
+    auto edit = array.Get(i).As<Napi::Object>();
+    result.push_back({position(edit.Get("begin").As<Napi::Object>()),
+                      position(edit.Get("end").As<Napi::Object>()),
+                      edit.Get("text").As<Napi::String>()});
   }
   return result;
 }
 
 template <typename T>
-static auto JSValue(Napi::Env env, const std::list<T>& list) -> Napi::Value {
+static auto JSValue(Napi::Env env,
+                    const std::vector<T>& vector) -> Napi::Value {
   auto result = Napi::Array::New(env);
-  for (const auto& item : list) {
+  for (const auto& item : vector) {
     result[result.Length()] = JSValue(env, item);
   }
   return result;
@@ -82,6 +56,21 @@ static auto JSValue(Napi::Env env, const LocationRange& range) -> Napi::Value {
   return result;
 }
 
+static auto JSValue(Napi::Env env, const GNPosition& position) -> Napi::Value {
+  auto result = Napi::Object::New(env);
+  result["line"] = position.line;
+  result["column"] = position.column;
+  return result;
+}
+
+static auto JSValue(Napi::Env env, const GNEdit& edit) -> Napi::Value {
+  auto result = Napi::Object::New(env);
+  result["begin"] = JSValue(env, edit.begin);
+  result["end"] = JSValue(env, edit.end);
+  result["text"] = edit.text;
+  return result;
+}
+
 static auto JSValue(Napi::Env env, const Err& err) -> Napi::Value {
   auto result = Napi::Object::New(env);
   result["location"] = JSValue(env, err.location());
@@ -91,7 +80,27 @@ static auto JSValue(Napi::Env env, const Err& err) -> Napi::Value {
   return result;
 }
 
-static auto JSValue(Napi::Env env, const GNContext& context) -> Napi::Value {
+static auto JSCompactValue(Napi::Env env,
+                           const LocationRange& range) -> Napi::Value {
+  auto result = Napi::Int32Array::New(env, 4);
+  result[0] = range.begin().line_number();
+  result[1] = range.begin().column_number();
+  result[2] = range.end().line_number();
+  result[3] = range.end().column_number();
+  return result;
+}
+
+template <typename T>
+static auto JSTypedArray(Napi::Env env,
+                         const std::vector<T>& values) -> Napi::Value {
+  auto result = Napi::TypedArrayOf<T>::New(env, values.size());
+  std::copy(values.begin(), values.end(), result.Data());
+  return result;
+}
+
+static auto JSValue(Napi::Env env,
+                    const GNContext& context,
+                    bool compact) -> Napi::Value {
   auto result = Napi::Object::New(env);
   result["root"] = context.root->value();
   if (context.token != nullptr) {
@@ -111,7 +120,9 @@ static auto JSValue(Napi::Env env, const GNContext& context) -> Napi::Value {
         break;
     }
     token["value"] = std::string(context.token->value());
-    token["range"] = JSValue(env, context.token->range());
+    auto range = GNShift(context.token->range(), context.lines);
+    token["range"] =
+        compact ? JSCompactValue(env, range) : JSValue(env, range);
     result["token"] = token;
   }
   if (context.function != nullptr) {
@@ -134,10 +145,41 @@ static auto JSValue(Napi::Env env, const GNContext& context) -> Napi::Value {
   return result;
 }
 
+static auto JSValue(Napi::Env env, const GNContext& context) -> Napi::Value {
+  return JSValue(env, context, false);
+}
+
+static auto JSCompactValue(Napi::Env env,
+                           const GNContext& context) -> Napi::Value {
+  return JSValue(env, context, true);
+}
+
+// Nested symbols from |begin| to |end| in the flat table of |scope|.
+static auto JSValue(Napi::Env env,
+                    const GNScope& scope,
+                    uint32_t begin,
+                    uint32_t end) -> Napi::Value {
+  auto result = Napi::Array::New(env);
+  for (auto i = begin; i < end; i = scope.symbols[i].end) {
+    const auto& symbol = scope.symbols[i];
+    auto value = Napi::Object::New(env);
+    value["kind"] = static_cast<int>(symbol.kind);
+    value["name"] = std::string(scope.GetName(symbol));
+    value["range"] = JSValue(env, symbol.range);
+    value["selectionRange"] = JSValue(env, symbol.selection_range);
+    if (symbol.end > i + 1) {
+      value["children"] = JSValue(env, scope, i + 1, symbol.end);
+    }
+    result[result.Length()] = value;
+  }
+  return result;
+}
+
 static auto JSValue(Napi::Env env, const GNScope& scope) -> Napi::Value {
   auto result = Napi::Object::New(env);
   auto declares = Napi::Array::New(env);
-  for (const auto& node : scope.declares) {
+  for (const auto& item : scope.declares) {
+    const auto* node = item.node;
     auto arguments = Napi::Array::New(env);
     for (const auto& argument : node->args()->contents()) {
       if (const auto* literal = argument->AsLiteral()) {
@@ -149,333 +191,115 @@ static auto JSValue(Napi::Env env, const GNScope& scope) -> Napi::Value {
     auto declare = Napi::Object::New(env);
     declare["function"] = std::string(node->function().value());
     declare["arguments"] = arguments;
-    declare["range"] =
-        JSValue(env, LocationRange(node->function().range().begin(),
-                                   node->block()->GetRange().begin()));
+    declare["range"] = JSValue(env, item.GetRange());
     declares[declares.Length()] = declare;
   }
   result["declares"] = declares;
-  result["symbols"] = JSValue(env, scope.symbols);
+  result["symbols"] =
+      JSValue(env, scope, 0, static_cast<uint32_t>(scope.symbols.size()));
   return result;
 }
 
 static auto JSValue(Napi::Env env,
-                    const GNDocumentSymbol& symbol) -> Napi::Value {
+                    const std::string& file,
+                    const GNRange& range) -> Napi::Value {
+  auto location = [&](int line, int column) {
+    auto result = Napi::Object::New(env);
+    result["file"] = file;
+    result["line"] = line;
+    result["column"] = column;
+    return result;
+  };
   auto result = Napi::Object::New(env);
-  result["kind"] = static_cast<int>(symbol.kind);
-  result["name"] = symbol.name;
-  result["range"] = JSValue(env, symbol.range);
-  result["selectionRange"] = JSValue(env, symbol.selection_range);
-  if (!symbol.children.empty()) {
-    result["children"] = JSValue(env, symbol.children);
-  }
+  result["begin"] = location(range.line, range.column);
+  result["end"] = location(range.end_line, range.end_column);
   return result;
 }
 
-class GNDocument {
+static auto JSValue(Napi::Env env,
+                    const GNIndexEntry& entry,
+                    const GNRange& range) -> Napi::Value {
+  return JSValue(env, entry.file, range);
+}
+
+static auto JSValue(Napi::Env env,
+                    const GNIndexEntry& entry,
+                    const GNDeclaration& declaration) -> Napi::Value {
+  auto result = Napi::Object::New(env);
+  result["function"] = declaration.function;
+  result["name"] = declaration.name;
+  result["range"] =
+      JSValue(env, entry,
+              GNRange{declaration.line, declaration.column,
+                      declaration.end_line, declaration.end_column});
+  return result;
+}
+
+static auto JSCompactValue(Napi::Env env, const GNScope& scope) -> Napi::Value {
+  GNCompactScope compact(scope);
+  auto declares = Napi::Object::New(env);
+  declares["names"] = JSTypedArray(env, compact.declare_names);
+  declares["counts"] = JSTypedArray(env, compact.declare_counts);
+  declares["ranges"] = JSTypedArray(env, compact.declare_ranges);
+  auto symbols = Napi::Object::New(env);
+  symbols["kinds"] = JSTypedArray(env, compact.kinds);
+  symbols["names"] = JSTypedArray(env, compact.names);
+  symbols["parents"] = JSTypedArray(env, compact.parents);
+  symbols["ranges"] = JSTypedArray(env, compact.ranges);
+  auto result = Napi::Object::New(env);
+  result["strings"] = compact.strings.strings;
+  result["offsets"] = JSTypedArray(env, compact.strings.offsets);
+  result["declares"] = declares;
+  result["symbols"] = symbols;
+  return result;
+}
+
+// Runs work off the JS thread and settles a promise with its result, which is
+// marshaled back on the JS thread.
+class GNWorker : public Napi::AsyncWorker {
  public:
-  explicit GNDocument(const std::string& file)
-      : file_(SourceFile(file)), root_(FindRoot()) {}
-  ~GNDocument() = default;
-  GNDocument(const GNDocument&) = delete;
-  GNDocument(GNDocument&&) = delete;
-  auto operator=(const GNDocument&) -> GNDocument& = delete;
-  auto operator=(GNDocument&&) -> GNDocument& = delete;
-
-  [[nodiscard]] auto GetError() const -> const Err& { return err_; }
-  [[nodiscard]] auto GetTokens() const -> const std::vector<Token>& {
-    return tokens_;
-  }
-  [[nodiscard]] auto GetNode() const -> const std::unique_ptr<ParseNode>& {
-    return node_;
-  }
-
-  auto UpdateContent(const std::string& content) {
-    file_.SetContents(content);
-    Err err;
-    auto tokens = Tokenizer::Tokenize(&file_, &err);
-    auto node = err.has_error() ? nullptr : Parser::Parse(tokens, &err);
-    if (!err.has_error()) {
-      tokens_ = std::move(tokens);
-      node_ = std::move(node);
-    }
-    err_ = err;
-  }
-
-  auto AnalyzeContext(int line, int column) -> GNContext {
-    GNContext context;
-    context.root = &root_;
-    auto nodes = TraversePath(Location(&file_, line, column));
-    if (const auto* last = nodes.empty() ? nullptr : nodes.back()) {
-      if (const auto* accessor = last->AsAccessor()) {
-        context.token = &accessor->base();
-      } else if (const auto* function_call = last->AsFunctionCall()) {
-        context.token = &function_call->function();
-      } else if (const auto* identifier = last->AsIdentifier()) {
-        context.token = &identifier->value();
-      } else if (const auto* literal = last->AsLiteral()) {
-        context.token = &literal->value();
-      }
-    }
-    for (auto it = nodes.rbegin(); it != nodes.rend(); it++) {
-      const auto* current = *it;
-      const auto* previous = it > nodes.rbegin() ? *(it - 1) : nullptr;
-      if (context.function == nullptr) {
-        const auto* function_call = current->AsFunctionCall();
-        const auto* block = previous != nullptr ? previous->AsBlock() : nullptr;
-        if (function_call != nullptr && block != nullptr) {
-          context.function = function_call;
-          break;
-        }
-      }
-      if (context.variable == nullptr) {
-        const auto* binary_op = current->AsBinaryOp();
-        const auto* identifier =
-            binary_op != nullptr ? binary_op->left()->AsIdentifier() : nullptr;
-        if (identifier != nullptr) {
-          context.variable = identifier;
-          continue;
-        }
-      }
-    }
-    return context;
-  }
+  using Marshal = std::function<Napi::Value(Napi::Env)>;
+  using Work = std::function<Marshal()>;
 
-  auto ParseScope() -> GNScope {
-    GNScope scope;
-    std::stack<const ParseNode*> nodes;
-    nodes.push(node_.get());
-    while (!nodes.empty()) {
-      const auto* node = nodes.top();
-      nodes.pop();
-      if (node == nullptr) {
-        continue;
-      }
-      if (const auto* block = node->AsBlock()) {
-        for (auto item = block->statements().rbegin();
-             item != block->statements().rend(); item++) {
-          nodes.push(item->get());
-        }
-      } else if (const auto* condition = node->AsCondition()) {
-        nodes.push(condition->if_false());
-        nodes.push(condition->if_true());
-      } else if (const auto* function_call = node->AsFunctionCall()) {
-        if (function_call->block() != nullptr) {
-          scope.declares.push_back(function_call);
-        }
-      }
-    }
-    scope.symbols = ConstructDocumentSymbolAST(node_.get());
-    return scope;
+  static auto Start(Napi::Env env, Work work) -> Napi::Value {
+    auto* worker = new GNWorker(env, std::move(work));  // NOLINT
+    auto promise = worker->deferred_.Promise();
+    worker->Queue();
+    return promise;
   }
 
-  auto FormatCode() -> std::string {
-    std::string result;
-    if (!err_.has_error() &&
-        commands::FormatStringToString(file_.contents(),
-                                       commands::TreeDumpMode::kInactive,
-                                       &result, nullptr)) {
-      return result;
-    }
-    return {};
+  // Does |work| right away on the JS thread.
+  static auto Run(Napi::Env env, const Work& work) -> Napi::Value {
+    return Settle(env, work());
   }
 
- private:
-  auto FindRoot() -> base::FilePath {
-    base::FilePath current =
-        UTF8ToFilePath(file_.dir().SourceWithNoTrailingSlash());
-    for (;;) {
-      base::FilePath file = current.Append(FILE_PATH_LITERAL(".gn"));
-      if (base::PathExists(file)) {
-        return current;
-      }
-      base::FilePath upper = current.StripTrailingSeparators().DirName();
-      if (current == upper) {
-        break;
-      }
-      current = std::move(upper);
-    }
-    return {};
+  static auto Settle(Napi::Env env, const Marshal& marshal) -> Napi::Value {
+    GNTimer timer(GNPhase::Marshal);
+    return marshal(env);
   }
 
-  auto TraversePath(const Location& location) -> std::vector<const ParseNode*> {
-    std::vector<const ParseNode*> result;
-    const ParseNode* current = nullptr;
-    auto contain = [](const LocationRange& range, const Location& location) {
-      return !(location < range.begin()) && (location < range.end());
-    };
-    auto next = [&](const ParseNode* node) {
-      if (node != nullptr && contain(node->GetRange(), location)) {
-        result.push_back(node);
-        current = node;
-        return true;
-      }
-      current = nullptr;
-      return false;
+  static auto Null() -> Work {
+    return [] {
+      return [](Napi::Env env) -> Napi::Value { return env.Null(); };
     };
-    next(node_.get());
-    while (current != nullptr) {
-      if (const auto* accessor = current->AsAccessor()) {
-        next(accessor->subscript()) || next(accessor->member());
-      } else if (const auto* binary_op = current->AsBinaryOp()) {
-        next(binary_op->left()) || next(binary_op->right());
-      } else if (const auto* block = current->AsBlock()) {
-        next(nullptr);
-        for (const auto& statement : block->statements()) {
-          if (next(statement.get())) {
-            break;
-          }
-        }
-      } else if (const auto* condition = current->AsCondition()) {
-        next(condition->condition()) || next(condition->if_true()) ||
-            next(condition->if_false());
-      } else if (const auto* function_call = current->AsFunctionCall()) {
-        next(function_call->args()) || next(function_call->block());
-      } else if (const auto* list = current->AsList()) {
-        next(nullptr);
-        for (const auto& content : list->contents()) {
-          if (next(content.get())) {
-            break;
-          }
-        }
-      } else if (const auto* unary_op = current->AsUnaryOp()) {
-        next(unary_op->operand());
-      } else {
-        break;
-      }
-    }
-    return result;
   }
 
-  static auto TokenToString(const Token& token) -> std::string_view {
-    return token.value();
+ protected:
+  void Execute() override { marshal_ = work_(); }
+  void OnOK() override { deferred_.Resolve(Settle(Env(), marshal_)); }
+  void OnError(const Napi::Error& error) override {
+    deferred_.Reject(error.Value());
   }
 
-  auto ExpressionToString(const ParseNode* node) -> std::string {
-    // TODO (linyhe): Use std::format and std::string_view once -std=c++20.
-    // Currently string_view do not provide .c_str(), which is not compatible
-    // for c-style formater (like base::StringFormat).
-    if (const auto* accessor = node->AsAccessor()) {
-      std::string_view base = accessor->base().value();
-      if (const auto* member = accessor->member()) {
-        // base.member
-        return std::string().append(base).append(".").append(
-            TokenToString(member->value()));
-      }
-      // base[subscript]
-      return std::string()
-          .append(base)
-          .append("[")
-          .append(ExpressionToString(accessor->subscript()))
-          .append("]");
-    }
-    if (const auto* binary_op = node->AsBinaryOp()) {
-      return ExpressionToString(binary_op->left())
-          .append(TokenToString(binary_op->op()))
-          .append(ExpressionToString(binary_op->right()));
-    }
-    if (const auto* identifier = node->AsIdentifier()) {
-      return std::string(TokenToString(identifier->value()));
-    }
-    if (const auto* unary_op = node->AsUnaryOp()) {
-      return std::string()
-          .append(TokenToString(unary_op->op()))
-          .append(ExpressionToString(unary_op->operand()));
-    }
-    if (const auto* function_call = node->AsFunctionCall()) {
-      return std::string()
-          .append(TokenToString(function_call->function()))
-          .append(ExpressionToString(function_call->args()));
-    }
-    if (const auto* list = node->AsList()) {
-      std::string str = std::string().append(TokenToString(list->Begin()));
-      for (size_t i = 0; i != list->contents().size(); i++) {
-        str.append(ExpressionToString(list->contents()[i].get()));
-        if (i != list->contents().size() - 1) {
-          str.append(", ");
-        }
-      }
-      return str.append(ExpressionToString(list->End()));
-    }
-    if (const auto* literal = node->AsLiteral()) {
-      return std::string(TokenToString(literal->value()));
-    }
-    if (const auto* end = node->AsEnd()) {
-      return std::string().append(TokenToString(end->value()));
-    }
-    return "UNKNOWN";
-  }
-
-  auto ConstructDocumentSymbolAST(const ParseNode* node)
-      -> std::list<GNDocumentSymbol> {
-    std::list<GNDocumentSymbol> result;
-    if (node == nullptr) {
-      return result;
-    }
-
-    // Only handle statement like node.
-    // StatementList = { Statement } .
-    // Statement     = Assignment | Call | Condition .
-    if (const auto* binary_op = node->AsBinaryOp()) {
-      // Assignment  = LValue AssignOp Expr .
-      // AssignOp    = "=" | "+=" | "-=" .
-      switch (binary_op->op().type()) {
-        case Token::EQUAL:
-        case Token::PLUS_EQUALS:
-        case Token::MINUS_EQUALS:
-          result.emplace_back() =
-              GNDocumentSymbol{GNSymbolKind::Variable,
-                               binary_op->GetRange(),
-                               ExpressionToString(binary_op->left()),
-                               binary_op->left()->GetRange(),
-                               {}};
-          break;
-        default:
-          break;
-      }
-    } else if (const auto* function_call = node->AsFunctionCall()) {
-      // Call        = identifier "(" [ ExprList ] ")" [ Block ] .
-      LocationRange selection_range = function_call->function().range().Union(
-          function_call->args()->GetRange());
-      GNDocumentSymbol symbol{GNSymbolKind::Function,
-                              function_call->GetRange(),
-                              ExpressionToString(function_call),
-                              selection_range,
-                              {}};
-      symbol.children = ConstructDocumentSymbolAST(function_call->block());
-      result.emplace_back() = std::move(symbol);
-    } else if (const auto* condition = node->AsCondition()) {
-      // Condition     = "if" "(" Expr ")" Block
-      //                 [ "else" ( Condition | Block ) ] .
-      GNDocumentSymbol symbol{GNSymbolKind::Boolean, condition->GetRange(),
-                              ExpressionToString(condition->condition()),
-                              condition->condition()->GetRange(),
-                              ConstructDocumentSymbolAST(condition->if_true())};
-      if (const auto* elseNode = condition->if_false(); elseNode != nullptr) {
-        // Explicit add else node.
-        // TODO(linyhe): selection_range for else node.
-        GNDocumentSymbol elseSymbol{
-            GNSymbolKind::Operator, elseNode->GetRange(), "else",
-            elseNode->GetRange(), ConstructDocumentSymbolAST(elseNode)};
-        symbol.children.emplace_back(elseSymbol);
-      }
-      result.emplace_back() = std::move(symbol);
-    } else if (const auto* block = node->AsBlock()) {
-      // Block        = "{" [ StatementList ] "}" .
-      for (const auto& statement : block->statements()) {
-        result.splice(result.end(),
-                      ConstructDocumentSymbolAST(statement.get()));
-      }
-    }
-    return result;
-  }
+ private:
+  GNWorker(Napi::Env env, Work work)
+      : Napi::AsyncWorker(env),
+        deferred_(Napi::Promise::Deferred::New(env)),
+        work_(std::move(work)) {}
 
-  InputFile file_;
-  base::FilePath root_;
-  Err err_;
-  std::vector<Token> tokens_;
-  // Root node of GN context.
-  std::unique_ptr<ParseNode> node_;
+  Napi::Promise::Deferred deferred_;
+  Work work_;
+  Marshal marshal_;
 };
 
 class GNAddon : public Napi::Addon<GNAddon> {
@@ -488,22 +312,77 @@ class GNAddon : public Napi::Addon<GNAddon> {
     DefineAddon(exports, {InstanceMethod("parse", &GNAddon::Parse)});
     DefineAddon(exports, {InstanceMethod("format", &GNAddon::Format)});
     DefineAddon(exports, {InstanceMethod("help", &GNAddon::Help)});
+    DefineAddon(exports, {InstanceMethod("catalog", &GNAddon::Catalog)});
+    DefineAddon(exports,
+                {InstanceMethod("updateAsync", &GNAddon::UpdateAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("analyzeAsync", &GNAddon::AnalyzeAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("parseAsync", &GNAddon::ParseAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("definitionAsync", &GNAddon::DefinitionAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("formatAsync", &GNAddon::FormatAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("formatEdits", &GNAddon::FormatEdits)});
+    DefineAddon(exports, {InstanceMethod("formatEditsAsync",
+                                         &GNAddon::FormatEditsAsync)});
+    DefineAddon(exports, {InstanceMethod("lookupLabelAsync",
+                                         &GNAddon::LookupLabelAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("listLabelsAsync", &GNAddon::ListLabelsAsync)});
+    DefineAddon(exports, {InstanceMethod("listImportsAsync",
+                                         &GNAddon::ListImportsAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("listDirectory", &GNAddon::ListDirectory)});
+    DefineAddon(exports,
+                {InstanceMethod("referencesAsync", &GNAddon::ReferencesAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("searchSymbols", &GNAddon::SearchSymbols)});
+    DefineAddon(exports, {InstanceMethod("invalidate", &GNAddon::Invalidate)});
+    DefineAddon(exports, {InstanceMethod("seedRoots", &GNAddon::SeedRoots)});
+    DefineAddon(exports, {InstanceMethod("checkDependenciesAsync",
+                                         &GNAddon::CheckDependenciesAsync)});
+    DefineAddon(exports,
+                {InstanceMethod("graphGeneration", &GNAddon::GraphGeneration)});
+    DefineAddon(exports,
+                {InstanceMethod("setIndexCache", &GNAddon::SetIndexCache)});
+    DefineAddon(exports,
+                {InstanceMethod("saveIndexAsync", &GNAddon::SaveIndexAsync)});
+    DefineAddon(exports, {InstanceMethod("parseMany", &GNAddon::ParseMany)});
+    DefineAddon(exports, {InstanceMethod("stats", &GNAddon::Stats)});
+    DefineAddon(exports, {InstanceMethod("resetStats", &GNAddon::ResetStats)});
+    DefineAddon(exports,
+                {InstanceMethod("setMemoryBudget", &GNAddon::SetMemoryBudget)});
+    DefineAddon(exports, {InstanceMethod("setInputVariables",
+                                         &GNAddon::SetInputVariables)});
+    DefineAddon(exports, {InstanceMethod("semanticTokensAsync",
+                                         &GNAddon::SemanticTokensAsync)});
   }
 
  private:
+  using GetSnapshot = std::function<std::shared_ptr<const GNSnapshot>()>;
+
   auto Update(const Napi::CallbackInfo& info) -> Napi::Value {
-    auto env = info.Env();
-    std::string file = info[0].As<Napi::String>();
-    std::string content = info[1].As<Napi::String>();
-    auto& document = documents_.try_emplace(file, file).first->second;
-    document.UpdateContent(content);
-    return env.Null();
+    return GNWorker::Run(info.Env(), UpdateWork(info));
+  }
+
+  auto UpdateAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), UpdateWork(info));
   }
 
   auto Close(const Napi::CallbackInfo& info) -> Napi::Value {
     auto env = info.Env();
     std::string file = info[0].As<Napi::String>();
-    documents_.erase(file);
+    if (documents_.erase(file) != 0) {
+      if (auto item = used_.find(file); item != used_.end()) {
+        recent_.erase(item->second);
+        used_.erase(item);
+      }
+      scopes_.erase(file);
+      tokens_.erase(file);
+      index_->Close(file);
+    }
     return env.Null();
   }
 
@@ -512,63 +391,655 @@ class GNAddon : public Napi::Addon<GNAddon> {
     std::string file = info[0].As<Napi::String>();
     auto item = documents_.find(file);
     if (item != documents_.end()) {
-      auto& document = item->second;
-      const auto& err = document.GetError();
+      auto snapshot = item->second->GetSnapshot();
+      const auto& err = snapshot->GetError();
       return err.has_error() ? JSValue(env, err) : env.Null();
     }
     return env.Null();
   }
 
   auto Analyze(const Napi::CallbackInfo& info) -> Napi::Value {
-    auto env = info.Env();
+    return GNWorker::Run(info.Env(), AnalyzeWork(info));
+  }
+
+  auto AnalyzeAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), AnalyzeWork(info));
+  }
+
+  auto Parse(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Run(info.Env(), ParseWork(info));
+  }
+
+  auto ParseAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), ParseWork(info));
+  }
+
+  auto Format(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Run(info.Env(), FormatWork(info));
+  }
+
+  auto FormatAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), FormatWork(info));
+  }
+
+  auto FormatEdits(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Run(info.Env(), FormatEditsWork(info));
+  }
+
+  auto FormatEditsAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), FormatEditsWork(info));
+  }
+
+  // The work of each call is set up on the JS thread and runs either right
+  // away or on a worker thread.
+  auto UpdateWork(const Napi::CallbackInfo& info) -> GNWorker::Work {
     std::string file = info[0].As<Napi::String>();
+    auto& document = documents_[file];
+    if (document == nullptr) {
+      auto root = roots_->Find(SourceFile(file));
+      document = std::make_shared<GNDocument>(file, std::move(root), memory_);
+      index_->Open(file, document.get());
+      index_->Crawl(document->GetRoot());
+    }
+    GNContent content;
+    if (info[1].IsArray()) {
+      content = ToEdits(info[1].As<Napi::Array>());
+    } else {
+      content = std::string(info[1].As<Napi::String>());
+    }
+    Touch(file);
+    auto turn = document->Reserve();
+    return [index = index_, file, document, turn,
+            content = std::move(content)]() mutable -> GNWorker::Marshal {
+      document->UpdateContent(turn, std::move(content));
+      auto snapshot = document->GetSnapshot(turn + 1);
+      index->Update(file, document.get(), turn + 1, snapshot);
+      return [snapshot](Napi::Env env) {
+        const auto& err = snapshot->GetError();
+        return err.has_error() ? JSValue(env, err) : env.Null();
+      };
+    };
+  }
+
+  auto AnalyzeWork(const Napi::CallbackInfo& info) -> GNWorker::Work {
     int line = info[1].As<Napi::Number>();
     int column = info[2].As<Napi::Number>();
-    auto item = documents_.find(file);
-    if (item != documents_.end()) {
-      auto& document = item->second;
-      auto context = document.AnalyzeContext(line, column);
-      return JSValue(env, context);
+    auto get_snapshot = FindSnapshot(info, 3);
+    if (get_snapshot == nullptr) {
+      return GNWorker::Null();
     }
-    return env.Null();
+    bool compact = info[4].ToBoolean();
+    return [get_snapshot, line, column, compact]() -> GNWorker::Marshal {
+      auto snapshot = get_snapshot();
+      auto context = snapshot->AnalyzeContext(line, column);
+      return [snapshot, context, compact](Napi::Env env) {
+        return compact ? JSCompactValue(env, context) : JSValue(env, context);
+      };
+    };
   }
 
-  auto Parse(const Napi::CallbackInfo& info) -> Napi::Value {
+  // Finds the assignment of the variable at |info[1]| and |info[2]|, in the
+  // file or else among the variables it imports.
+  auto DefinitionAsync(const Napi::CallbackInfo& info) -> Napi::Value {
     auto env = info.Env();
+    int line = info[1].As<Napi::Number>();
+    int column = info[2].As<Napi::Number>();
+    auto get_snapshot = FindSnapshot(info, 3);
+    if (get_snapshot == nullptr) {
+      return GNWorker::Start(env, GNWorker::Null());
+    }
     std::string file = info[0].As<Napi::String>();
-    auto item = documents_.find(file);
-    if (item != documents_.end()) {
-      auto& document = item->second;
-      auto scope = document.ParseScope();
-      return JSValue(env, scope);
+    auto root = roots_->Find(SourceFile(file));
+    return GNWorker::Start(env, [index = index_, file, root, get_snapshot,
+                                 line, column]() -> GNWorker::Marshal {
+      auto snapshot = get_snapshot();
+      auto definition = snapshot->FindDefinition(line, column);
+      std::shared_ptr<const GNIndexEntry> entry;
+      const GNDeclaration* variable = nullptr;
+      if (definition.assignment == nullptr && !definition.name.empty()) {
+        for (const auto& item : index->FindImports(file, root)) {
+          auto found = std::find_if(item->variables.begin(),
+                                    item->variables.end(),
+                                    [&](const GNDeclaration& declaration) {
+                                      return declaration.name ==
+                                             definition.name;
+                                    });
+          if (found != item->variables.end()) {
+            entry = item;
+            variable = &*found;
+            break;
+          }
+        }
+      }
+      return [snapshot, definition, entry, variable](Napi::Env env) {
+        auto result = Napi::Object::New(env);
+        result["name"] = std::string(definition.name);
+        if (definition.assignment != nullptr) {
+          result["range"] =
+              JSValue(env, GNShift(definition.assignment->left()->GetRange(),
+                                   definition.lines));
+          result["text"] = std::string(definition.text);
+        } else if (variable != nullptr) {
+          result["range"] =
+              JSValue(env, *entry,
+                      GNRange{variable->line, variable->column,
+                              variable->end_line, variable->end_column});
+        } else {
+          return env.Null();
+        }
+        return Napi::Value(result);
+      };
+    });
+  }
+
+  auto ParseWork(const Napi::CallbackInfo& info) -> GNWorker::Work {
+    auto get_snapshot = FindSnapshot(info, 1);
+    if (get_snapshot == nullptr) {
+      return GNWorker::Null();
     }
-    if (info.Length() > 1) {
-      std::string content = info[1].As<Napi::String>();
-      GNDocument document(file);
-      document.UpdateContent(content);
-      auto scope = document.ParseScope();
-      return JSValue(env, scope);
+    std::string file = info[0].As<Napi::String>();
+    bool compact = info[2].ToBoolean();
+    return [this, file, get_snapshot, compact]() -> GNWorker::Marshal {
+      auto snapshot = get_snapshot();
+      // Computed here, off the JS thread when async.
+      static_cast<void>(snapshot->ParseScope());
+      return [this, file, snapshot, compact](Napi::Env env) {
+        return MarshalScope(env, file, snapshot, compact);
+      };
+    };
+  }
+
+  // Reuses the last result marshaled for the same snapshot of an open file.
+  auto MarshalScope(Napi::Env env,
+                    const std::string& file,
+                    const std::shared_ptr<const GNSnapshot>& snapshot,
+                    bool compact) -> Napi::Value {
+    auto marshal = [&] {
+      const auto& scope = snapshot->ParseScope();
+      return compact ? JSCompactValue(env, scope) : JSValue(env, scope);
+    };
+    if (documents_.count(file) == 0) {
+      return marshal();
     }
-    return env.Null();
+    auto& scope = scopes_[file];
+    if (scope.snapshot != snapshot) {
+      scope = {snapshot, {}, {}};
+    }
+    auto& value = compact ? scope.compact : scope.value;
+    if (value.IsEmpty()) {
+      value = Napi::Persistent(marshal().As<Napi::Object>());
+    }
+    return value.Value();
   }
 
-  auto Format(const Napi::CallbackInfo& info) -> Napi::Value {
+  auto FormatWork(const Napi::CallbackInfo& info) -> GNWorker::Work {
+    auto get_snapshot = FindSnapshot(info, 1);
+    if (get_snapshot == nullptr) {
+      return GNWorker::Null();
+    }
+    return [get_snapshot]() -> GNWorker::Marshal {
+      auto code = get_snapshot()->FormatCode();
+      return [code = std::move(code)](Napi::Env env) -> Napi::Value {
+        return Napi::String::New(env, code);
+      };
+    };
+  }
+
+  // Formats the lines |info[2]| to |info[3]| when given, else all of them.
+  auto FormatEditsWork(const Napi::CallbackInfo& info) -> GNWorker::Work {
+    auto get_snapshot = FindSnapshot(info, 1);
+    if (get_snapshot == nullptr) {
+      return GNWorker::Null();
+    }
+    auto range = info[2].IsNumber() && info[3].IsNumber();
+    auto first = range ? info[2].As<Napi::Number>().Int32Value() : 0;
+    auto last = range ? info[3].As<Napi::Number>().Int32Value() : 0;
+    return [get_snapshot, range, first, last]() -> GNWorker::Marshal {
+      auto snapshot = get_snapshot();
+      auto edits = range ? snapshot->FormatEdits(first, last)
+                         : snapshot->FormatEdits();
+      return [edits = std::move(edits)](Napi::Env env) -> Napi::Value {
+        return JSValue(env, edits);
+      };
+    };
+  }
+
+  // Sets the variables whose strings are labels |info[0]| or paths |info[1]|.
+  auto SetInputVariables(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto inputs = std::make_shared<GNInputVariables>();
+    auto add = [](const Napi::Array& array, auto& names) {
+      for (uint32_t i = 0; i < array.Length(); i++) {
+        names.insert(array.Get(i).As<Napi::String>());
+      }
+    };
+    add(info[0].As<Napi::Array>(), inputs->labels);
+    add(info[1].As<Napi::Array>(), inputs->paths);
+    inputs_ = std::move(inputs);
+    tokens_.clear();
+    return info.Env().Null();
+  }
+
+  // Semantic tokens of the open file |info[0]|, as the edits to the result
+  // |info[1]| when it is the last one, else in full.
+  auto SemanticTokensAsync(const Napi::CallbackInfo& info) -> Napi::Value {
     auto env = info.Env();
     std::string file = info[0].As<Napi::String>();
+    if (documents_.count(file) == 0) {
+      return GNWorker::Start(env, GNWorker::Null());
+    }
+    auto get_snapshot = FindSnapshot(info, 2);
+    auto previous = tokens_[file];
+    if (!info[1].IsString() ||
+        std::string(info[1].As<Napi::String>()) != previous.id) {
+      previous.data = nullptr;
+    }
+    auto work = [this, file, get_snapshot, inputs = inputs_,
+                 previous]() -> GNWorker::Marshal {
+      auto snapshot = get_snapshot();
+      auto data = snapshot == previous.snapshot && previous.data != nullptr
+                      ? previous.data
+                      : std::make_shared<const std::vector<uint32_t>>(
+                            snapshot->GetSemanticTokens(*inputs));
+      return [this, file, snapshot, data, previous](Napi::Env env) {
+        auto id = std::to_string(++token_id_);
+        if (documents_.count(file) != 0) {
+          tokens_[file] = {snapshot, id, data};
+        }
+        auto result = Napi::Object::New(env);
+        result["resultId"] = id;
+        if (previous.data == nullptr) {
+          result["data"] = JSTypedArray(env, *data);
+          return result;
+        }
+        // One edit from the first to the last value changed.
+        const auto& before = *previous.data;
+        const auto& after = *data;
+        size_t prefix = 0;
+        while (prefix < before.size() && prefix < after.size() &&
+               before[prefix] == after[prefix]) {
+          prefix++;
+        }
+        size_t suffix = 0;
+        while (suffix < before.size() - prefix &&
+               suffix < after.size() - prefix &&
+               before[before.size() - 1 - suffix] ==
+                   after[after.size() - 1 - suffix]) {
+          suffix++;
+        }
+        auto edits = Napi::Array::New(env);
+        if (prefix != before.size() || prefix != after.size()) {
+          auto edit = Napi::Object::New(env);
+          edit["start"] = prefix;
+          edit["deleteCount"] = before.size() - prefix - suffix;
+          edit["data"] = JSTypedArray(
+              env, std::vector<uint32_t>(
+                       after.begin() + static_cast<ptrdiff_t>(prefix),
+                       after.end() - static_cast<ptrdiff_t>(suffix)));
+          edits[edits.Length()] = edit;
+        }
+        result["edits"] = edits;
+        return result;
+      };
+    };
+    return GNWorker::Start(env, work);
+  }
+
+  // Reads and parses the files |info[0]| in parallel, off the JS thread.
+  auto ParseMany(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto array = info[0].As<Napi::Array>();
+    std::vector<std::string> files;
+    for (uint32_t i = 0; i < array.Length(); i++) {
+      files.push_back(array.Get(i).As<Napi::String>());
+    }
+    return GNWorker::Start(info.Env(), [pool = pool_, roots = roots_,
+                                        files = std::move(files)] {
+      std::vector<std::shared_ptr<const GNSnapshot>> snapshots(files.size());
+      pool->ForEach(files.size(), [&](size_t index) {
+        const auto& file = files[index];
+        std::string contents;
+        if (!base::ReadFileToString(UTF8ToFilePath(file), &contents)) {
+          return;
+        }
+        GNDocument document(file, roots->Find(SourceFile(file)));
+        document.UpdateContent(std::move(contents));
+        auto snapshot = document.GetSnapshot();
+        static_cast<void>(snapshot->ParseScope());
+        snapshots[index] = std::move(snapshot);
+      });
+      return [snapshots = std::move(snapshots)](Napi::Env env) -> Napi::Value {
+        auto result = Napi::Array::New(env);
+        for (const auto& snapshot : snapshots) {
+          if (snapshot == nullptr) {
+            result[result.Length()] = env.Null();
+            continue;
+          }
+          const auto& err = snapshot->GetError();
+          auto item = Napi::Object::New(env);
+          item["error"] = err.has_error() ? JSValue(env, err) : env.Null();
+          item["scope"] = JSValue(env, snapshot->ParseScope());
+          result[result.Length()] = item;
+        }
+        return result;
+      };
+    });
+  }
+
+  // Gets the state of the open document |info[0]| as of this call, or of its
+  // content given in |info[index]| when it is not open.
+  auto FindSnapshot(const Napi::CallbackInfo& info, size_t index)
+      -> GetSnapshot {
+    std::string file = info[0].As<Napi::String>();
     auto item = documents_.find(file);
     if (item != documents_.end()) {
-      auto& document = item->second;
-      return Napi::String::New(env, document.FormatCode());
+      Touch(file);
+      auto document = item->second;
+      auto version = document->GetVersion();
+      return [document, version] { return document->GetSnapshot(version); };
     }
-    if (info.Length() > 1) {
-      std::string content = info[1].As<Napi::String>();
-      GNDocument document(file);
-      document.UpdateContent(content);
-      return Napi::String::New(env, document.FormatCode());
+    if (info[index].IsString()) {
+      std::string content = info[index].As<Napi::String>();
+      return [roots = roots_, file, content = std::move(content)] {
+        GNDocument document(file, roots->Find(SourceFile(file)));
+        document.UpdateContent(content);
+        return document.GetSnapshot();
+      };
     }
+    return nullptr;
+  }
+
+  // Finds the label |info[1]| declared in the BUILD.gn of directory |info[0]|,
+  // loading the file away from the main thread if not indexed yet.
+  auto LookupLabelAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string directory = info[0].As<Napi::String>();
+    std::string name = info[1].As<Napi::String>();
+    return GNWorker::Start(
+        info.Env(),
+        [index = index_, directory, name]() -> GNWorker::Marshal {
+          auto entry = index->Find(GetBuildFile(directory));
+          if (entry == nullptr || entry->labels.count(name) == 0) {
+            return GNWorker::Null()();
+          }
+          return [entry, name](Napi::Env env) {
+            return JSValue(env, *entry,
+                           entry->declarations[entry->labels.at(name)]);
+          };
+        });
+  }
+
+  auto ListLabelsAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string directory = info[0].As<Napi::String>();
+    return GNWorker::Start(
+        info.Env(), [index = index_, directory]() -> GNWorker::Marshal {
+          auto entry = index->Find(GetBuildFile(directory));
+          if (entry == nullptr) {
+            return GNWorker::Null()();
+          }
+          return [entry](Napi::Env env) -> Napi::Value {
+            auto result = Napi::Array::New(env);
+            for (const auto& declaration : entry->declarations) {
+              result[result.Length()] = JSValue(env, *entry, declaration);
+            }
+            return result;
+          };
+        });
+  }
+
+  // Finds the uses of the name at line |info[1]| and column |info[2]| of file
+  // |info[0]|, as of its last update: across the index for labels, templates
+  // and imported variables, else in the file alone. None for builtins.
+  auto ReferencesAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string file = info[0].As<Napi::String>();
+    int line = info[1].As<Napi::Number>();
+    int column = info[2].As<Napi::Number>();
+    auto root = roots_->Find(SourceFile(file));
+    return GNWorker::Start(info.Env(), [index = index_, file, root, line,
+                                        column]() -> GNWorker::Marshal {
+      auto entry = index->Find(file);
+      const auto* name =
+          entry != nullptr ? entry->FindReference(line, column) : nullptr;
+      // Builtins are used by every file, and not to be renamed.
+      if (name == nullptr || functions::GetFunctions().count(*name) != 0 ||
+          variables::GetBuiltinVariables().count(*name) != 0 ||
+          variables::GetTargetVariables().count(*name) != 0) {
+        return GNWorker::Null()();
+      }
+      bool label = name->rfind("//", 0) == 0;
+      // Others are the file's own.
+      auto entries = label || index->IsShared(file, root, *name)
+                         ? index->FindReferences(*name)
+                         : std::vector{entry};
+      return [entries, name = *name](Napi::Env env) {
+        auto ranges = Napi::Array::New(env);
+        for (const auto& item : entries) {
+          for (const auto& range : item->references.at(name)) {
+            ranges[ranges.Length()] = JSValue(env, *item, range);
+          }
+        }
+        auto result = Napi::Object::New(env);
+        result["name"] = name;
+        result["ranges"] = ranges;
+        return result;
+      };
+    });
+  }
+
+  // Finds the |info[1]| declarations and top-level variables of the index
+  // best matching |info[0]|.
+  auto SearchSymbols(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    std::string query = info[0].As<Napi::String>();
+    auto limit = info[1].As<Napi::Number>().Uint32Value();
+    auto result = Napi::Array::New(env);
+    for (const auto& match : index_->Search(query, limit)) {
+      result[result.Length()] = JSValue(env, *match.entry, *match.declaration);
+    }
+    return result;
+  }
+
+  // Finds the unresolved labels and the cycles in the deps of build file
+  // |info[0]|, as indexed.
+  auto CheckDependenciesAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string file = info[0].As<Napi::String>();
+    auto root = roots_->Find(SourceFile(file));
+    return GNWorker::Start(
+        info.Env(), [index = index_, file, root]() -> GNWorker::Marshal {
+          auto diagnostics = index->CheckDependencies(file, root);
+          return [file, diagnostics](Napi::Env env) {
+            auto result = Napi::Array::New(env);
+            for (const auto& diagnostic : diagnostics) {
+              auto value = Napi::Object::New(env);
+              value["range"] = JSValue(env, file, diagnostic.range);
+              value["message"] = diagnostic.message;
+              result[result.Length()] = value;
+            }
+            return result;
+          };
+        });
+  }
+
+  // Lists the templates and variables imported by file |info[0]|, loading the
+  // imports not indexed yet away from the main thread.
+  auto ListImportsAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string file = info[0].As<Napi::String>();
+    auto root = roots_->Find(SourceFile(file));
+    return GNWorker::Start(
+        info.Env(), [index = index_, file, root]() -> GNWorker::Marshal {
+          auto entries = index->FindImports(file, root);
+          return [entries](Napi::Env env) {
+            auto templates = Napi::Array::New(env);
+            auto variables = Napi::Array::New(env);
+            std::set<std::string_view> names;
+            for (const auto& entry : entries) {
+              for (const auto& declaration : entry->declarations) {
+                if (declaration.function == functions::kTemplate) {
+                  templates[templates.Length()] =
+                      JSValue(env, *entry, declaration);
+                }
+              }
+              for (const auto& variable : entry->variables) {
+                if (names.insert(variable.name).second) {
+                  variables[variables.Length()] = variable.name;
+                }
+              }
+            }
+            auto result = Napi::Object::New(env);
+            result["templates"] = templates;
+            result["variables"] = variables;
+            return result;
+          };
+        });
+  }
+
+  // Lists directory |info[0]|, only its subdirectories if |info[1]|.
+  auto ListDirectory(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    std::string directory = info[0].As<Napi::String>();
+    bool directories_only = info[1].ToBoolean();
+    auto result = Napi::Array::New(env);
+    for (const auto& entry : *directories_.List(directory)) {
+      if (directories_only && !entry.directory) {
+        continue;
+      }
+      auto value = Napi::Object::New(env);
+      value["name"] = entry.name;
+      value["isDirectory"] = entry.directory;
+      result[result.Length()] = value;
+    }
+    return result;
+  }
+
+  auto Invalidate(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    std::string file = info[0].As<Napi::String>();
+    if (UTF8ToFilePath(file).BaseName().value() == FILE_PATH_LITERAL(".gn")) {
+      roots_->Invalidate();
+    }
+    directories_.Invalidate(file);
+    index_->Invalidate(file);
     return env.Null();
   }
 
+  // Finds the roots of the directories |info[0]| ahead of their first files,
+  // and starts indexing them.
+  auto SeedRoots(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    auto directories = info[0].As<Napi::Array>();
+    for (uint32_t i = 0; i < directories.Length(); i++) {
+      std::string directory = directories.Get(i).As<Napi::String>();
+      index_->Crawl(roots_->Find(UTF8ToFilePath(directory)));
+    }
+    return env.Null();
+  }
+
+  // Keeps the index in directory |info[0]| between sessions, or nowhere if
+  // empty.
+  auto SetIndexCache(const Napi::CallbackInfo& info) -> Napi::Value {
+    std::string directory = info[0].As<Napi::String>();
+    index_->SetCache(directory.empty() ? base::FilePath()
+                                       : UTF8ToFilePath(directory).Append(
+                                             FILE_PATH_LITERAL("index.cache")));
+    return info.Env().Null();
+  }
+
+  auto SaveIndexAsync(const Napi::CallbackInfo& info) -> Napi::Value {
+    return GNWorker::Start(info.Env(), [index = index_] {
+      index->Save();
+      return GNWorker::Null()();
+    });
+  }
+
+  // Changes when the targets or deps of an indexed file do.
+  auto GraphGeneration(const Napi::CallbackInfo& info) -> Napi::Value {
+    return Napi::Number::New(
+        info.Env(), static_cast<double>(index_->GetGraphGeneration()));
+  }
+
+  static auto GetBuildFile(const std::string& directory) -> std::string {
+    return FilePathToUTF8(
+        UTF8ToFilePath(directory).Append(FILE_PATH_LITERAL("BUILD.gn")));
+  }
+
+  auto Stats(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    constexpr const char* kPhases[] = {"tokenize", "parse",  "scope",
+                                       "analyze",  "format", "marshal"};
+    constexpr double kMedian = 0.5;
+    constexpr double kHigh = 0.9;
+    constexpr double kHighest = 0.99;
+    auto stats = GNStats::Get();
+    auto phases = Napi::Object::New(env);
+    for (size_t i = 0; i < GNStats::kPhases; i++) {
+      const auto& stat = stats[i];
+      auto buckets = Napi::Array::New(env);
+      for (auto bucket : stat.buckets) {
+        buckets[buckets.Length()] = static_cast<double>(bucket);
+      }
+      auto phase = Napi::Object::New(env);
+      phase["count"] = static_cast<double>(stat.count);
+      phase["microseconds"] = static_cast<double>(stat.microseconds);
+      phase["p50"] = static_cast<double>(stat.GetPercentile(kMedian));
+      phase["p90"] = static_cast<double>(stat.GetPercentile(kHigh));
+      phase["p99"] = static_cast<double>(stat.GetPercentile(kHighest));
+      phase["buckets"] = buckets;
+      phases[kPhases[i]] = phase;
+    }
+    auto documents = Napi::Array::New(env);
+    for (const auto& [file, document] : documents_) {
+      auto stat = document->GetStats();
+      auto item = Napi::Object::New(env);
+      item["file"] = file;
+      item["bytes"] = static_cast<double>(stat.bytes);
+      item["tokens"] = static_cast<double>(stat.tokens);
+      item["treeBytes"] = static_cast<double>(stat.tree_bytes);
+      documents[documents.Length()] = item;
+    }
+    auto result = Napi::Object::New(env);
+    result["phases"] = phases;
+    result["documents"] = documents;
+    return result;
+  }
+
+  auto ResetStats(const Napi::CallbackInfo& info) -> Napi::Value {
+    GNStats::Reset();
+    return info.Env().Null();
+  }
+
+  // Sets the bytes that open documents may take before being evicted.
+  auto SetMemoryBudget(const Napi::CallbackInfo& info) -> Napi::Value {
+    budget_ = static_cast<size_t>(info[0].As<Napi::Number>().DoubleValue());
+    Enforce();
+    return info.Env().Null();
+  }
+
+  // Marks the open document |file| as the most recently used.
+  void Touch(const std::string& file) {
+    auto item = used_.find(file);
+    if (item != used_.end()) {
+      recent_.splice(recent_.end(), recent_, item->second);
+    } else {
+      used_.emplace(file, recent_.insert(recent_.end(), file));
+    }
+    Enforce();
+  }
+
+  // Evicts the least recently used documents while over the memory budget.
+  // They leave the list until used again.
+  void Enforce() {
+    auto item = recent_.begin();
+    // Keeps the document in use, at the end.
+    while (*memory_ > budget_ && item != recent_.end() &&
+           std::next(item) != recent_.end()) {
+      if (!documents_[*item]->Evict()) {
+        ++item;
+        continue;
+      }
+      scopes_.erase(*item);
+      tokens_.erase(*item);
+      used_.erase(*item);
+      item = recent_.erase(item);
+    }
+  }
+
   auto Help(const Napi::CallbackInfo& info) -> Napi::Value {
     auto env = info.Env();
     std::string type = info[0].As<Napi::String>();
@@ -614,7 +1085,76 @@ class GNAddon : public Napi::Addon<GNAddon> {
     return env.Null();
   }
 
-  std::map<std::string, GNDocument> documents_;
+  // Short help and link of every function and variable, built once for all
+  // completions.
+  auto Catalog(const Napi::CallbackInfo& info) -> Napi::Value {
+    auto env = info.Env();
+    if (!catalog_.IsEmpty()) {
+      return catalog_.Value();
+    }
+    auto add = [&](Napi::Object& object, std::string_view name,
+                   const char* help, const char* anchor) {
+      std::string key(name);
+      if (object.Has(key)) {
+        return;
+      }
+      auto entry = Napi::Object::New(env);
+      entry["basic"] = help;
+      entry["link"] = link_ + anchor + key;
+      object[key] = entry;
+    };
+    auto functions = Napi::Object::New(env);
+    for (const auto& [name, function] : functions::GetFunctions()) {
+      add(functions, name, function.help_short, "#func_");
+    }
+    // Builtin variables first, as in Help().
+    auto variables = Napi::Object::New(env);
+    for (const auto& [name, variable] : variables::GetBuiltinVariables()) {
+      add(variables, name, variable.help_short, "#var_");
+    }
+    for (const auto& [name, variable] : variables::GetTargetVariables()) {
+      add(variables, name, variable.help_short, "#var_");
+    }
+    auto result = Napi::Object::New(env);
+    result["functions"] = functions;
+    result["variables"] = variables;
+    catalog_ = Napi::Persistent(result);
+    return result;
+  }
+
+  static constexpr size_t kDefaultBudget = size_t{512} << 20;
+
+  struct GNSemanticTokens {
+    std::shared_ptr<const GNSnapshot> snapshot;
+    std::string id;
+    std::shared_ptr<const std::vector<uint32_t>> data;
+  };
+
+  struct GNMarshaledScope {
+    std::shared_ptr<const GNSnapshot> snapshot;
+    Napi::ObjectReference value;
+    Napi::ObjectReference compact;
+  };
+
+  std::shared_ptr<GNThreadPool> pool_ = std::make_shared<GNThreadPool>();
+  std::shared_ptr<GNRoots> roots_ = std::make_shared<GNRoots>();
+  GNDirectories directories_;
+  std::shared_ptr<GNIndex> index_ = std::make_shared<GNIndex>(roots_);
+  std::map<std::string, std::shared_ptr<GNDocument>> documents_;
+  std::map<std::string, GNMarshaledScope> scopes_;
+  // Variables whose strings are colored as labels or paths.
+  std::shared_ptr<const GNInputVariables> inputs_ =
+      std::make_shared<GNInputVariables>();
+  // Last semantic tokens sent for each open file, to send edits to them next.
+  std::map<std::string, GNSemanticTokens> tokens_;
+  uint64_t token_id_ = 0;
+  // Memory budget of open documents, the bytes they hold, and those not
+  // evicted from least to most recently used.
+  size_t budget_ = kDefaultBudget;
+  std::shared_ptr<GNMemory> memory_ = std::make_shared<GNMemory>(0);
+  std::list<std::string> recent_;
+  std::unordered_map<std::string, std::list<std::string>::iterator> used_;
+  Napi::ObjectReference catalog_;
   std::string link_ = "https://gn.googlesource.com/gn/+/main/docs/reference.md";
 };
 
@@ -0,0 +1,191 @@
+// Measures the language features over synthetic BUILD.gn files of growing
+// size, to catch regressions such as when the gn commit is updated.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "core.h"
+
+// Allocations made by everything, counted as a proxy for their cost.
+static std::atomic<size_t> allocations = 0;
+
+auto operator new(size_t size) -> void* {
+  allocations++;
+  void* result = std::malloc(size != 0 ? size : 1);  // NOLINT
+  if (result == nullptr) {
+    std::abort();
+  }
+  return result;
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);  // NOLINT
+}
+
+void operator delete(void* pointer, size_t /*size*/) noexcept {
+  std::free(pointer);  // NOLINT
+}
+
+struct GNMeasure {
+  double seconds = 0;
+  double allocations = 0;
+};
+
+// Average cost of one |run|, repeated |count| times.
+template <typename F>
+static auto Measure(size_t count, F run) -> GNMeasure {
+  auto allocated = allocations.load();
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    run(i);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  return {elapsed.count() / static_cast<double>(count),
+          static_cast<double>(allocations.load() - allocated) /
+              static_cast<double>(count)};
+}
+
+static void Report(size_t lines,
+                   const char* name,
+                   size_t bytes,
+                   const GNMeasure& measure) {
+  constexpr double kMicroseconds = 1e6;
+  constexpr double kMegabytes = 1 << 20;
+  std::printf("%8zu %-10s %12.2f %10.2f %14.1f\n", lines, name,
+              measure.seconds * kMicroseconds,
+              bytes != 0 ? static_cast<double>(bytes) / kMegabytes /
+                               measure.seconds
+                         : 0.0,
+              measure.allocations);
+}
+
+// A BUILD.gn of about |lines| lines, with targets shaped like Chromium ones.
+static auto MakeBuildFile(size_t lines) -> std::string {
+  constexpr size_t kSources = 10;
+  std::string result = "import(\"//build/config/features.gni\")\n\n";
+  size_t count = 2;
+  for (size_t target = 0; count < lines; target++) {
+    auto name = "target_" + std::to_string(target);
+    result += "# Target " + std::to_string(target) + ".\n";
+    result += "source_set(\"" + name + "\") {\n  sources = [\n";
+    for (size_t source = 0; source < kSources; source++) {
+      result += "    \"" + name + "_" + std::to_string(source) + ".cc\",\n";
+    }
+    result += "  ]\n  deps = [ \":target_" + std::to_string(target + 1) +
+              "\" ]\n";
+    result += "  if (is_linux) {\n    defines = [ \"LINUX\" ]\n  }\n}\n\n";
+    count += kSources + 9;
+  }
+  return result;
+}
+
+// Returns whether the edits kept the statements they did not touch.
+static auto Run(size_t lines) -> bool {
+  // Keeps the total work about the same for every size.
+  constexpr size_t kWork = 1000000;
+  constexpr size_t kPositions = 1000;
+  auto iterations = std::max<size_t>(1, kWork / lines);
+  auto text = MakeBuildFile(lines);
+  auto bytes = text.size();
+  std::string path = "//BUILD.gn";
+
+  auto update = Measure(iterations, [&](size_t) {
+    GNDocument document(path, {});
+    document.UpdateContent(text);
+  });
+  Report(lines, "update", bytes, update);
+
+  GNDocument document(path, {});
+  document.UpdateContent(text);
+  // The first target from the middle on, so that edits go between statements
+  // and the others are reused, rather than into a list failing to parse.
+  auto offset = text.find("# Target", text.size() / 2);
+  offset = offset != std::string::npos ? offset : text.rfind("# Target");
+  auto middle = static_cast<int>(
+      1 + std::count(text.begin(),
+                     text.begin() + static_cast<ptrdiff_t>(offset), '\n'));
+  auto edit = Measure(iterations, [&](size_t i) {
+    // Alternately inserts and removes a line in the middle.
+    std::vector<GNEdit> edits(1);
+    edits[0].begin = {middle, 1};
+    edits[0].end = {i % 2 == 0 ? middle : middle + 1, 1};
+    edits[0].text = i % 2 == 0 ? "foo = 1\n" : "";
+    document.UpdateContent(edits);
+  });
+  Report(lines, "edit", 0, edit);
+
+  // A newline moves all the statements after it, which are still kept rather
+  // than parsed again.
+  auto tail = document.GetSnapshot()->GetStatements().back().chunk;
+  auto newline = Measure(iterations, [&](size_t i) {
+    std::vector<GNEdit> edits(1);
+    edits[0].begin = {middle, 1};
+    edits[0].end = {i % 2 == 0 ? middle : middle + 1, 1};
+    edits[0].text = i % 2 == 0 ? "\n" : "";
+    document.UpdateContent(edits);
+  });
+  Report(lines, "newline", 0, newline);
+  if (document.GetSnapshot()->GetStatements().back().chunk != tail) {
+    std::fprintf(stderr, "Statements after a newline were parsed again.\n");
+    return false;
+  }
+
+  // Scopes are computed once per snapshot, so each run gets a fresh one.
+  auto snapshot = document.GetSnapshot();
+  auto file = std::make_shared<const InputFile>(SourceFile(path));
+  auto contents = std::make_shared<const std::string>(text);
+  std::vector<std::unique_ptr<GNSnapshot>> snapshots;
+  for (size_t i = 0; i < iterations; i++) {
+    snapshots.push_back(std::make_unique<GNSnapshot>(
+        file, base::FilePath(), contents, snapshot->GetStatements(),
+        snapshot->GetError()));
+  }
+  auto scope = Measure(iterations, [&](size_t i) {
+    static_cast<void>(snapshots[i]->ParseScope());
+  });
+  Report(lines, "scope", bytes, scope);
+
+  // Marshaling itself needs a JS engine, this is the part before it.
+  auto marshal = Measure(iterations, [&](size_t) {
+    GNCompactScope compact(snapshot->ParseScope());
+  });
+  Report(lines, "marshal", bytes, marshal);
+
+  auto analyze = Measure(kPositions, [&](size_t i) {
+    auto line = static_cast<int>(1 + i * lines / kPositions);
+    static_cast<void>(snapshot->AnalyzeContext(line, 8));
+  });
+  Report(lines, "analyze", 0, analyze);
+
+  auto definition = Measure(kPositions, [&](size_t i) {
+    auto line = static_cast<int>(1 + i * lines / kPositions);
+    static_cast<void>(snapshot->FindDefinition(line, 3));
+  });
+  Report(lines, "definition", 0, definition);
+
+  auto format = Measure(iterations, [&](size_t) {
+    static_cast<void>(snapshot->FormatCode());
+  });
+  Report(lines, "format", bytes, format);
+  return true;
+}
+
+auto main() -> int {
+  constexpr size_t kSizes[] = {100, 1000, 10000, 100000};
+  std::printf("%8s %-10s %12s %10s %14s\n", "lines", "operation", "us/op",
+              "MB/s", "allocations/op");
+  for (auto lines : kSizes) {
+    if (!Run(lines)) {
+      return 1;
+    }
+  }
+  return 0;
+}
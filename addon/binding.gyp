@@ -2,16 +2,8 @@
   'variables': {
     'rootdir': '<!(node -p "process.cwd()")',
   },
-  'targets': [{
-    'target_name': 'addon',
-    'sources': [
-      'addon.cc',
-    ],
-    'defines': [
-      'NAPI_DISABLE_CPP_EXCEPTIONS',
-    ],
+  'target_defaults': {
     'include_dirs': [
-      '<!@(node -p "require(\'node-addon-api\').include")',
       '<(rootdir)/gn/src',
     ],
     'libraries': [
@@ -67,5 +59,24 @@
         ],
       }],
     ],
+  },
+  'targets': [{
+    'target_name': 'addon',
+    'sources': [
+      'addon.cc',
+    ],
+    'defines': [
+      'NAPI_DISABLE_CPP_EXCEPTIONS',
+    ],
+    'include_dirs': [
+      '<!@(node -p "require(\'node-addon-api\').include")',
+    ],
+  }, {
+    # Measures the costs of the language features, see bench.cc.
+    'target_name': 'bench',
+    'type': 'executable',
+    'sources': [
+      'bench.cc',
+    ],
   }]
 }
@@ -0,0 +1,3584 @@
+// Language features of GN files, independent of how they are exposed to JS.
+
+#ifndef GNLS_ADDON_CORE_H_
+#define GNLS_ADDON_CORE_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <set>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <gn/command_format.h>
+#include <gn/filesystem_utils.h>
+#include <gn/functions.h>
+#include <gn/input_file.h>
+#include <gn/location.h>
+#include <gn/parse_tree.h>
+#include <gn/parser.h>
+#include <gn/token.h>
+#include <gn/tokenizer.h>
+#include <gn/variables.h>
+
+// |location| moved down by |lines| lines.
+inline auto GNShift(const Location& location, int lines) -> Location {
+  if (lines == 0 || location.file() == nullptr) {
+    return location;
+  }
+  return Location(location.file(), location.line_number() + lines,
+                  location.column_number());
+}
+
+inline auto GNShift(const LocationRange& range, int lines) -> LocationRange {
+  return LocationRange(GNShift(range.begin(), lines),
+                       GNShift(range.end(), lines));
+}
+
+// Nodes at a position. Their statement moved down |lines| lines since it was
+// parsed, which their locations are to be shifted by.
+struct GNContext {
+  const base::FilePath* root = nullptr;
+  const Token* token = nullptr;
+  const FunctionCallNode* function = nullptr;
+  const IdentifierNode* variable = nullptr;
+  int lines = 0;
+};
+
+// Variable at a position, and its assignment in the document if any, with the
+// line of the assignment and the lines its statement moved.
+struct GNDefinition {
+  std::string_view name;
+  const BinaryOpNode* assignment = nullptr;
+  std::string_view text;
+  int lines = 0;
+};
+
+enum class GNSymbolKind : std::uint8_t {
+  Unknown = 0,
+  Function = 12,
+  Variable = 13,
+  Boolean = 17,
+  Operator = 25,
+};
+
+// Semantic token types, in the order of the legend given to the editor.
+enum class GNTokenType : std::uint8_t {
+  Function = 0,
+  Target = 1,
+  Variable = 2,
+  TargetVariable = 3,
+  Label = 4,
+  Path = 5,
+};
+
+// Semantic token modifiers, as bits in the order of the legend.
+enum class GNTokenModifier : std::uint8_t {
+  None = 0,
+  Builtin = 1,
+};
+
+// Variables whose strings are labels or paths.
+struct GNInputVariables {
+  std::set<std::string, std::less<>> labels;
+  std::set<std::string, std::less<>> paths;
+};
+
+// Symbol in the flat table of a scope, with its name in the table's buffer.
+struct GNDocumentSymbol {
+  GNSymbolKind kind = GNSymbolKind::Unknown;
+  LocationRange range;
+  LocationRange selection_range;
+  uint32_t name_offset = 0;
+  uint32_t name_length = 0;
+  // Index of the parent or -1, and the index past the last descendant.
+  int32_t parent = -1;
+  uint32_t end = 0;
+};
+
+// Call with a block, as a target or template declaration, in a statement that
+// moved down |lines| lines since it was parsed.
+struct GNDeclare {
+  const FunctionCallNode* node = nullptr;
+  int lines = 0;
+
+  // From the function name to the block.
+  [[nodiscard]] auto GetRange() const -> LocationRange {
+    return GNShift(LocationRange(node->function().range().begin(),
+                                 node->block()->GetRange().begin()),
+                   lines);
+  }
+};
+
+struct GNScope {
+  std::vector<GNDeclare> declares;
+  // Symbols in preorder, so the children of one are the following ones up to
+  // its |end|, skipping their own descendants.
+  std::vector<GNDocumentSymbol> symbols;
+  std::string names;
+
+  [[nodiscard]] auto GetName(const GNDocumentSymbol& symbol) const
+      -> std::string_view {
+    return std::string_view(names).substr(symbol.name_offset,
+                                          symbol.name_length);
+  }
+};
+
+struct GNPosition {
+  int line = 0;
+  // Counted in UTF-16 code units, as LSP does.
+  int column = 0;
+};
+
+struct GNEdit {
+  GNPosition begin;
+  GNPosition end;
+  std::string text;
+};
+
+// Parse result of a run of tokens. Holds the text the tokens refer to, so its
+// nodes stay valid while the document content changes around them: a copy of
+// the run, or the whole content when the run covers it.
+struct GNChunk {
+  std::shared_ptr<const std::string> contents;
+  std::unique_ptr<ParseNode> node;
+};
+
+struct GNStatement {
+  std::shared_ptr<const GNChunk> chunk;
+  const ParseNode* node = nullptr;
+  // Index of the first token of this statement in the document tokens.
+  size_t token = 0;
+  // Lines the statement moved down since it was parsed, by edits before it,
+  // to add to the locations of its nodes.
+  int lines = 0;
+};
+
+// A call declaring a label, as indexed for the workspace.
+struct GNDeclaration {
+  // Name of the function called, or the one given to target().
+  std::string function;
+  std::string name;
+  int line = 0;
+  int column = 0;
+  int end_line = 0;
+  int end_column = 0;
+};
+
+struct GNIndexEntry;
+
+// Declaration or variable found searching the index, in |entry|.
+struct GNSymbolMatch {
+  std::shared_ptr<const GNIndexEntry> entry;
+  const GNDeclaration* declaration = nullptr;
+};
+
+struct GNRange {
+  int line = 0;
+  int column = 0;
+  int end_line = 0;
+  int end_column = 0;
+};
+
+// Label in the deps or public_deps of a declaration, made source-absolute.
+struct GNDependency {
+  // Index of the declaration in the entry.
+  size_t declaration = 0;
+  std::string label;
+  GNRange range;
+};
+
+struct GNIndexEntry {
+  std::string file;
+  std::vector<GNDeclaration> declarations;
+  // Index of the first declaration of each label.
+  std::unordered_map<std::string, size_t> labels;
+  // Files imported as written, including the build config of a .gn file, and
+  // the variables visible to files importing this one.
+  std::vector<std::string> imports;
+  // Variables with an empty function, each at its first assignment.
+  std::vector<GNDeclaration> variables;
+  // Ranges of the identifiers and labels used, by name. Labels are made
+  // source-absolute with a target name, like //base:base.
+  std::unordered_map<std::string, std::vector<GNRange>> references;
+  std::vector<GNDependency> dependencies;
+  // Ranges of |references| sorted by position, pointing to their names.
+  std::vector<std::pair<GNRange, const std::string*>> positions;
+
+  // Sorts the ranges of |references| by position, once all are added.
+  void SortPositions() {
+    positions.clear();
+    for (const auto& [name, ranges] : references) {
+      for (const auto& range : ranges) {
+        positions.emplace_back(range, &name);
+      }
+    }
+    std::sort(positions.begin(), positions.end(),
+              [](const auto& a, const auto& b) {
+                return std::tie(a.first.line, a.first.column) <
+                       std::tie(b.first.line, b.first.column);
+              });
+  }
+
+  // Gets the name used at |line| and |column|, or null.
+  auto FindReference(int line, int column) const -> const std::string* {
+    auto position = std::tie(line, column);
+    // The last range beginning at or before the position, as none overlap.
+    auto item = std::upper_bound(
+        positions.begin(), positions.end(), position,
+        [](const auto& at, const auto& other) {
+          return at < std::tie(other.first.line, other.first.column);
+        });
+    if (item == positions.begin()) {
+      return nullptr;
+    }
+    const auto& [range, name] = *std::prev(item);
+    return position < std::tie(range.end_line, range.end_column) ? name
+                                                                  : nullptr;
+  }
+};
+
+// Problem found in a file beyond its syntax.
+struct GNDiagnostic {
+  GNRange range;
+  std::string message;
+};
+
+enum class GNPhase : std::uint8_t {
+  Tokenize,
+  Parse,
+  Scope,
+  Analyze,
+  Format,
+  Marshal,
+};
+
+// Counts and latencies of the phases of the work. Counters are kept per
+// thread, so that recording takes no lock, and are summed when read.
+class GNStats {
+ public:
+  static constexpr size_t kPhases = 6;
+  // Bucket |i| counts latencies under 2^|i| microseconds not counted by the
+  // previous ones, and the last bucket all longer ones.
+  static constexpr size_t kBuckets = 24;
+
+  struct Phase {
+    uint64_t count = 0;
+    uint64_t microseconds = 0;
+    std::array<uint64_t, kBuckets> buckets = {};
+
+    // Upper bound of the latency of the |quantile| of the calls.
+    [[nodiscard]] auto GetPercentile(double quantile) const -> uint64_t {
+      if (count == 0) {
+        return 0;
+      }
+      auto rank = static_cast<uint64_t>(quantile * static_cast<double>(count));
+      uint64_t total = 0;
+      for (size_t i = 0; i + 1 < kBuckets; i++) {
+        total += buckets[i];
+        if (total > rank) {
+          return uint64_t{1} << i;
+        }
+      }
+      return uint64_t{1} << (kBuckets - 1);
+    }
+  };
+
+  static void Record(GNPhase phase, std::chrono::steady_clock::duration time) {
+    auto microseconds = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+    size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (uint64_t{1} << bucket) <= microseconds) {
+      bucket++;
+    }
+    // Only this thread writes its counters, relaxed atomics suffice.
+    auto& counters = GetCounters()[static_cast<size_t>(phase)];
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.microseconds.fetch_add(microseconds, std::memory_order_relaxed);
+    counters.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static auto Get() -> std::array<Phase, kPhases> {
+    std::array<Phase, kPhases> result;
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& counters : registry.threads) {
+      for (size_t i = 0; i < kPhases; i++) {
+        const auto& phase = (*counters)[i];
+        result[i].count += phase.count.load(std::memory_order_relaxed);
+        result[i].microseconds +=
+            phase.microseconds.load(std::memory_order_relaxed);
+        for (size_t j = 0; j < kBuckets; j++) {
+          result[i].buckets[j] +=
+              phase.buckets[j].load(std::memory_order_relaxed);
+        }
+      }
+    }
+    return result;
+  }
+
+  static void Reset() {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto& counters : registry.threads) {
+      for (auto& phase : *counters) {
+        phase.count.store(0, std::memory_order_relaxed);
+        phase.microseconds.store(0, std::memory_order_relaxed);
+        for (auto& bucket : phase.buckets) {
+          bucket.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+ private:
+  struct Counters {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> microseconds = 0;
+    std::array<std::atomic<uint64_t>, kBuckets> buckets = {};
+  };
+  using ThreadCounters = std::array<Counters, kPhases>;
+
+  // Counters of all threads that recorded, kept after the threads end.
+  struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadCounters>> threads;
+  };
+
+  static auto GetRegistry() -> Registry& {
+    // Never destroyed, as threads may record until the process exits.
+    static auto* registry = new Registry();  // NOLINT
+    return *registry;
+  }
+
+  static auto GetCounters() -> ThreadCounters& {
+    thread_local ThreadCounters* counters = [] {
+      auto& registry = GetRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      return registry.threads.emplace_back(std::make_unique<ThreadCounters>())
+          .get();
+    }();
+    return *counters;
+  }
+};
+
+// Records the time from its construction to its destruction for |phase|.
+class GNTimer {
+ public:
+  explicit GNTimer(GNPhase phase)
+      : phase_(phase), begin_(std::chrono::steady_clock::now()) {}
+  ~GNTimer() {
+    GNStats::Record(phase_, std::chrono::steady_clock::now() - begin_);
+  }
+  GNTimer(const GNTimer&) = delete;
+  GNTimer(GNTimer&&) = delete;
+  auto operator=(const GNTimer&) -> GNTimer& = delete;
+  auto operator=(GNTimer&&) -> GNTimer& = delete;
+
+ private:
+  GNPhase phase_;
+  std::chrono::steady_clock::time_point begin_;
+};
+
+struct GNDocumentStats {
+  size_t bytes = 0;
+  size_t tokens = 0;
+  // Approximate memory held by the parse tree.
+  size_t tree_bytes = 0;
+};
+
+// Bytes held by a set of documents, kept as each changes.
+using GNMemory = std::atomic<size_t>;
+
+// Length of UTF-8 |text| in UTF-16 code units, as JS strings count them.
+inline auto GetUTF16Length(std::string_view text) -> uint32_t {
+  // Continuation bytes add nothing, and lead bytes from this one on start
+  // sequences taking a surrogate pair.
+  constexpr unsigned char kContinuation = 0xC0;
+  constexpr unsigned char kContinuationBits = 0x80;
+  constexpr unsigned char kFourBytes = 0xF0;
+  uint32_t result = 0;
+  for (auto byte : text) {
+    auto value = static_cast<unsigned char>(byte);
+    if ((value & kContinuation) != kContinuationBits) {
+      result += value < kFourBytes ? 1 : 2;
+    }
+  }
+  return result;
+}
+
+// Strings sent as one JS string, each string found by its offsets.
+struct GNStringTable {
+  std::string strings;
+  std::vector<uint32_t> offsets = {0};
+
+  auto Add(std::string_view value) -> uint32_t {
+    strings.append(value);
+    offsets.push_back(offsets.back() + GetUTF16Length(value));
+    return static_cast<uint32_t>(offsets.size() - 2);
+  }
+};
+
+// Scope flattened for compact marshaling, with ranges packed as line/column
+// quadruples and strings in a table. Symbols are in preorder, each with the
+// index of its parent or -1.
+struct GNCompactScope {
+  explicit GNCompactScope(const GNScope& scope) {
+    for (const auto& declare : scope.declares) {
+      const auto* node = declare.node;
+      declare_names.push_back(strings.Add(node->function().value()));
+      const auto& arguments = node->args()->contents();
+      for (const auto& argument : arguments) {
+        const auto* literal = argument->AsLiteral();
+        strings.Add(literal != nullptr ? literal->value().value() : "");
+      }
+      declare_counts.push_back(static_cast<uint32_t>(arguments.size()));
+      AddRange(declare_ranges, declare.GetRange());
+    }
+    for (const auto& symbol : scope.symbols) {
+      kinds.push_back(static_cast<uint8_t>(symbol.kind));
+      names.push_back(strings.Add(scope.GetName(symbol)));
+      parents.push_back(symbol.parent);
+      AddRange(ranges, symbol.range);
+      AddRange(ranges, symbol.selection_range);
+    }
+  }
+
+  GNStringTable strings;
+  std::vector<uint32_t> declare_names;
+  std::vector<uint32_t> declare_counts;
+  std::vector<int32_t> declare_ranges;
+  std::vector<uint8_t> kinds;
+  std::vector<uint32_t> names;
+  std::vector<int32_t> parents;
+  std::vector<int32_t> ranges;
+
+ private:
+  static void AddRange(std::vector<int32_t>& ranges,
+                       const LocationRange& range) {
+    ranges.insert(ranges.end(),
+                  {range.begin().line_number(), range.begin().column_number(),
+                   range.end().line_number(), range.end().column_number()});
+  }
+};
+
+// Edits turning |before| into |after| line by line, with lines numbered from
+// |line|. Differing lines are matched by a Myers diff, given up for a single
+// edit when there are too many differences for it to be worth it.
+inline auto GNDiffLines(std::string_view before,
+                        std::string_view after,
+                        int line = 1) -> std::vector<GNEdit> {
+  constexpr int kMaxDifferences = 1000;
+  auto split = [](std::string_view text) {
+    std::vector<std::string_view> result;
+    while (!text.empty()) {
+      auto end = text.find('\n');
+      end = end == std::string_view::npos ? text.size() : end + 1;
+      result.push_back(text.substr(0, end));
+      text.remove_prefix(end);
+    }
+    return result;
+  };
+  auto a = split(before);
+  auto b = split(after);
+  // Lines the same at both ends are left out of the diff.
+  size_t prefix = 0;
+  while (prefix < a.size() && prefix < b.size() && a[prefix] == b[prefix]) {
+    prefix++;
+  }
+  size_t suffix = 0;
+  while (suffix < a.size() - prefix && suffix < b.size() - prefix &&
+         a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix]) {
+    suffix++;
+  }
+  auto n = static_cast<int>(a.size() - prefix - suffix);
+  auto m = static_cast<int>(b.size() - prefix - suffix);
+  if (n == 0 && m == 0) {
+    return {};
+  }
+
+  // |trace[d]| holds, for each diagonal k from -d to d, the furthest line of
+  // |a| reached with d differences.
+  std::vector<std::vector<int>> trace;
+  auto furthest = [&](int d, int k) { return trace[d][k + d]; };
+  auto down = [&](int d, int k) {
+    return k == -d || (k != d && furthest(d - 1, k - 1) <
+                                     furthest(d - 1, k + 1));
+  };
+  auto equal = [&](int x, int y) { return a[prefix + x] == b[prefix + y]; };
+  bool found = false;
+  for (int d = 0; d <= std::min(n + m, kMaxDifferences) && !found; d++) {
+    trace.emplace_back(2 * d + 1);
+    for (int k = -d; k <= d; k += 2) {
+      int x = 0;
+      if (d != 0) {
+        x = down(d, k) ? furthest(d - 1, k + 1) : furthest(d - 1, k - 1) + 1;
+      }
+      auto y = x - k;
+      while (x < n && y < m && equal(x, y)) {
+        x++;
+        y++;
+      }
+      trace[d][k + d] = x;
+      if (x >= n && y >= m) {
+        found = true;
+        break;
+      }
+    }
+  }
+
+  std::vector<bool> removed(n, !found);
+  std::vector<bool> added(m, !found);
+  if (found) {
+    int x = n;
+    int y = m;
+    for (auto d = static_cast<int>(trace.size()) - 1; d > 0; d--) {
+      auto k = x - y;
+      auto previous = down(d, k) ? k + 1 : k - 1;
+      auto previous_x = furthest(d - 1, previous);
+      if (previous == k + 1) {
+        added[previous_x - previous] = true;
+      } else {
+        removed[previous_x] = true;
+      }
+      x = previous_x;
+      y = previous_x - previous;
+    }
+  }
+
+  // Each run of removed and added lines becomes one edit.
+  std::vector<GNEdit> result;
+  int x = 0;
+  int y = 0;
+  while (x < n || y < m) {
+    if (x < n && y < m && !removed[x] && !added[y]) {
+      x++;
+      y++;
+      continue;
+    }
+    GNEdit edit;
+    edit.begin = {line + static_cast<int>(prefix) + x, 1};
+    while ((x < n && removed[x]) || (y < m && added[y])) {
+      if (x < n && removed[x]) {
+        x++;
+      } else {
+        edit.text.append(b[prefix + y]);
+        y++;
+      }
+    }
+    edit.end = {line + static_cast<int>(prefix) + x, 1};
+    result.push_back(std::move(edit));
+  }
+  return result;
+}
+
+// Immutable state of one version of a document, shared with work running off
+// the JS thread.
+class GNSnapshot {
+ public:
+  GNSnapshot(std::shared_ptr<const InputFile> file,
+             base::FilePath root,
+             std::shared_ptr<const std::string> contents,
+             std::vector<GNStatement> statements,
+             Err err)
+      : file_(std::move(file)),
+        root_(std::move(root)),
+        contents_(std::move(contents)),
+        statements_(std::move(statements)),
+        err_(std::move(err)) {}
+
+  [[nodiscard]] auto GetError() const -> const Err& { return err_; }
+  [[nodiscard]] auto GetStatements() const
+      -> const std::vector<GNStatement>& {
+    return statements_;
+  }
+
+  [[nodiscard]] auto AnalyzeContext(int line, int column) const -> GNContext {
+    GNTimer timer(GNPhase::Analyze);
+    GNContext context;
+    context.root = &root_;
+    auto nodes =
+        TraversePath(Location(file_.get(), line, column), &context.lines);
+    if (const auto* last = nodes.empty() ? nullptr : nodes.back()) {
+      if (const auto* accessor = last->AsAccessor()) {
+        context.token = &accessor->base();
+      } else if (const auto* function_call = last->AsFunctionCall()) {
+        context.token = &function_call->function();
+      } else if (const auto* identifier = last->AsIdentifier()) {
+        context.token = &identifier->value();
+      } else if (const auto* literal = last->AsLiteral()) {
+        context.token = &literal->value();
+      }
+    }
+    for (auto it = nodes.rbegin(); it != nodes.rend(); it++) {
+      const auto* current = *it;
+      const auto* previous = it > nodes.rbegin() ? *(it - 1) : nullptr;
+      if (context.function == nullptr) {
+        const auto* function_call = current->AsFunctionCall();
+        const auto* block = previous != nullptr ? previous->AsBlock() : nullptr;
+        if (function_call != nullptr && block != nullptr) {
+          context.function = function_call;
+          break;
+        }
+      }
+      if (context.variable == nullptr) {
+        const auto* binary_op = current->AsBinaryOp();
+        const auto* identifier =
+            binary_op != nullptr ? binary_op->left()->AsIdentifier() : nullptr;
+        if (identifier != nullptr) {
+          context.variable = identifier;
+          continue;
+        }
+      }
+    }
+    return context;
+  }
+
+  // Finds the assignment of the variable at |line| and |column| in the
+  // innermost scope around it that assigns it: the last one up to there, else
+  // the first after. Conditions and foreach() share the scope they are in.
+  [[nodiscard]] auto FindDefinition(int line, int column) const
+      -> GNDefinition {
+    GNTimer timer(GNPhase::Analyze);
+    GNDefinition result;
+    auto location = Location(file_.get(), line, column);
+    auto nodes = TraversePath(location, &result.lines);
+    const auto* last = nodes.empty() ? nullptr : nodes.back();
+    if (last == nullptr) {
+      return result;
+    }
+    if (const auto* accessor = last->AsAccessor()) {
+      result.name = accessor->base().value();
+    } else if (const auto* identifier = last->AsIdentifier()) {
+      result.name = identifier->value().value();
+    } else {
+      return result;
+    }
+    const auto& assignments = GetAssignments();
+    auto item = assignments.find(result.name);
+    if (item == assignments.end()) {
+      return result;
+    }
+    // From the innermost, ending with the one of the file.
+    std::vector<const BlockNode*> scopes;
+    for (size_t i = nodes.size() - 1; i > 0; i--) {
+      const auto* function_call = nodes[i - 1]->AsFunctionCall();
+      if (function_call != nullptr && nodes[i] == function_call->block() &&
+          IsScope(function_call)) {
+        scopes.push_back(function_call->block());
+      }
+    }
+    scopes.push_back(nullptr);
+    for (const auto* scope : scopes) {
+      const GNAssignment* found = nullptr;
+      for (const auto& assignment : item->second) {
+        if (assignment.scope != scope) {
+          continue;
+        }
+        // In the order of the document.
+        bool before =
+            !(location < GNShift(assignment.node->GetRange().begin(),
+                                 assignment.statement->lines));
+        if (found != nullptr && !before) {
+          break;
+        }
+        found = &assignment;
+      }
+      if (found != nullptr) {
+        result.assignment = found->node;
+        result.text = GetLine(*found);
+        result.lines = found->statement->lines;
+        return result;
+      }
+    }
+    return result;
+  }
+
+  // Computed once per snapshot, as the editor asks for it repeatedly.
+  [[nodiscard]] auto ParseScope() const -> const GNScope& {
+    std::call_once(scope_once_, [this] { scope_ = MakeScope(); });
+    return scope_;
+  }
+
+  [[nodiscard]] auto FormatCode() const -> std::string {
+    GNTimer timer(GNPhase::Format);
+    std::string result;
+    if (!err_.has_error() && Format(*contents_, result)) {
+      return result;
+    }
+    return {};
+  }
+
+  // Semantic tokens in the LSP encoding: for each, its line relative to the
+  // previous one, its column relative to the previous one on the same line,
+  // its length, type and modifiers.
+  [[nodiscard]] auto GetSemanticTokens(const GNInputVariables& inputs) const
+      -> std::vector<uint32_t> {
+    std::vector<GNSemanticToken> tokens;
+    for (const auto& statement : statements_) {
+      auto begin = tokens.size();
+      AddSemanticTokens(inputs, statement.node, {}, tokens);
+      for (auto i = begin; i < tokens.size(); i++) {
+        tokens[i].line += static_cast<uint32_t>(statement.lines);
+      }
+    }
+    std::sort(tokens.begin(), tokens.end(),
+              [](const GNSemanticToken& a, const GNSemanticToken& b) {
+                return std::tie(a.line, a.column) < std::tie(b.line, b.column);
+              });
+    // Columns are in bytes until here, where LSP counts UTF-16 code units,
+    // converted along each line.
+    std::string_view contents = *contents_;
+    size_t offset = 0;
+    uint32_t current = 0;
+    uint32_t bytes = 0;
+    uint32_t units = 0;
+    for (auto& token : tokens) {
+      for (; current < token.line && offset != std::string_view::npos;
+           current++) {
+        offset = contents.find('\n', offset);
+        offset = offset != std::string_view::npos ? offset + 1 : offset;
+        bytes = 0;
+        units = 0;
+      }
+      if (offset == std::string_view::npos ||
+          offset + token.column > contents.size()) {
+        break;
+      }
+      units += GetUTF16Length(
+          contents.substr(offset + bytes, token.column - bytes));
+      bytes = token.column;
+      token.column = units;
+    }
+    std::vector<uint32_t> result;
+    result.reserve(tokens.size() * 5);
+    uint32_t line = 0;
+    uint32_t column = 0;
+    for (const auto& token : tokens) {
+      result.insert(result.end(),
+                    {token.line - line,
+                     token.line == line ? token.column - column : token.column,
+                     token.length, static_cast<uint32_t>(token.type),
+                     static_cast<uint32_t>(token.modifier)});
+      line = token.line;
+      column = token.column;
+    }
+    return result;
+  }
+
+  // Edits formatting the document, touching only the lines that change.
+  [[nodiscard]] auto FormatEdits() const -> std::vector<GNEdit> {
+    GNTimer timer(GNPhase::Format);
+    std::string result;
+    if (!err_.has_error() && Format(*contents_, result)) {
+      return GNDiffLines(*contents_, result);
+    }
+    return {};
+  }
+
+  // Edits formatting the top-level statements on lines |first| to |last|,
+  // formatted apart from the rest of the document.
+  [[nodiscard]] auto FormatEdits(int first, int last) const
+      -> std::vector<GNEdit> {
+    GNTimer timer(GNPhase::Format);
+    // Takes whole lines, so also the statements sharing one with them.
+    bool found = false;
+    for (bool grown = true; grown;) {
+      grown = false;
+      for (const auto& statement : statements_) {
+        if (statement.node == nullptr) {
+          continue;
+        }
+        auto range = GNShift(statement.node->GetRange(), statement.lines);
+        auto begin = range.begin().line_number();
+        auto end = range.end().line_number();
+        if (end < first || begin > last) {
+          continue;
+        }
+        found = true;
+        if (begin < first || end > last) {
+          first = std::min(first, begin);
+          last = std::max(last, end);
+          grown = true;
+        }
+      }
+    }
+    if (!found) {
+      return {};
+    }
+    std::string_view contents = *contents_;
+    size_t begin = 0;
+    for (int line = 1; line < first && begin != std::string_view::npos;
+         line++) {
+      begin = contents.find('\n', begin);
+      begin = begin != std::string_view::npos ? begin + 1 : begin;
+    }
+    auto end = begin;
+    for (int line = first; line <= last && end != std::string_view::npos;
+         line++) {
+      end = contents.find('\n', end);
+      end = end != std::string_view::npos ? end + 1 : end;
+    }
+    if (begin == std::string_view::npos) {
+      return {};
+    }
+    auto text = std::string(contents.substr(begin, end - begin));
+    std::string result;
+    if (Format(text, result)) {
+      return GNDiffLines(text, result, first);
+    }
+    return {};
+  }
+
+ private:
+  static auto Format(const std::string& text, std::string& result) -> bool {
+    return commands::FormatStringToString(
+        text, commands::TreeDumpMode::kInactive, &result, nullptr);
+  }
+
+  struct GNSemanticToken {
+    uint32_t line = 0;
+    // In bytes, then in UTF-16 code units.
+    uint32_t column = 0;
+    uint32_t length = 0;
+    GNTokenType type = GNTokenType::Function;
+    GNTokenModifier modifier = GNTokenModifier::None;
+  };
+
+  // Assignment of a variable with "=", in the scope of the call with block
+  // |scope|, or of the file when null.
+  struct GNAssignment {
+    const BlockNode* scope = nullptr;
+    const BinaryOpNode* node = nullptr;
+    // Top-level statement of the node, with the chunk it was parsed from.
+    const GNStatement* statement = nullptr;
+  };
+
+  using GNAssignments =
+      std::unordered_map<std::string_view, std::vector<GNAssignment>>;
+
+  // Computed once per snapshot, so that each lookup is a hash probe and a
+  // walk up the scopes.
+  auto GetAssignments() const -> const GNAssignments& {
+    std::call_once(assignments_once_, [this] {
+      for (const auto& statement : statements_) {
+        AddAssignments(assignments_, statement, statement.node, nullptr);
+      }
+    });
+    return assignments_;
+  }
+
+  // Whether the block of |function_call| has a scope of its own, which all do
+  // but the ones of foreach() and declare_args().
+  static auto IsScope(const FunctionCallNode* function_call) -> bool {
+    auto function = function_call->function().value();
+    return function != functions::kForEach &&
+           function != functions::kDeclareArgs;
+  }
+
+  // Adds the assignments of |node| in top-level |statement| to |scope|, in
+  // order.
+  static void AddAssignments(GNAssignments& assignments,
+                             const GNStatement& statement,
+                             const ParseNode* node,
+                             const BlockNode* scope) {
+    if (node == nullptr) {
+      return;
+    }
+    if (const auto* binary_op = node->AsBinaryOp()) {
+      const auto* identifier = binary_op->left()->AsIdentifier();
+      if (identifier != nullptr && binary_op->op().type() == Token::EQUAL) {
+        assignments[identifier->value().value()].push_back(
+            {scope, binary_op, &statement});
+      }
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      const auto* block = function_call->block();
+      AddAssignments(assignments, statement, block,
+                     block != nullptr && IsScope(function_call) ? block
+                                                                : scope);
+    } else if (const auto* condition = node->AsCondition()) {
+      AddAssignments(assignments, statement, condition->if_true(), scope);
+      AddAssignments(assignments, statement, condition->if_false(), scope);
+    } else if (const auto* block = node->AsBlock()) {
+      for (const auto& item : block->statements()) {
+        AddAssignments(assignments, statement, item.get(), scope);
+      }
+    }
+  }
+
+  // Line on which |assignment| starts, without the indentation.
+  static auto GetLine(const GNAssignment& assignment) -> std::string_view {
+    const auto& name = assignment.node->left()->AsIdentifier()->value();
+    std::string_view contents = *assignment.statement->chunk->contents;
+    auto offset = static_cast<size_t>(name.value().data() - contents.data());
+    auto begin = contents.rfind('\n', offset);
+    begin = begin != std::string_view::npos ? begin + 1 : 0;
+    auto end = std::min(contents.find('\n', offset), contents.size());
+    auto line = contents.substr(begin, end - begin);
+    auto indent = std::min(line.find_first_not_of(" \t"), line.size());
+    return line.substr(indent);
+  }
+
+  // Adds the tokens of |node|, in the value of |variable| if any.
+  static void AddSemanticTokens(const GNInputVariables& inputs,
+                                const ParseNode* node,
+                                std::string_view variable,
+                                std::vector<GNSemanticToken>& tokens) {
+    if (node == nullptr) {
+      return;
+    }
+    auto add = [&](const Token& token, GNTokenType type,
+                   GNTokenModifier modifier = GNTokenModifier::None) {
+      auto begin = token.range().begin();
+      tokens.push_back({static_cast<uint32_t>(begin.line_number() - 1),
+                        static_cast<uint32_t>(begin.column_number() - 1),
+                        GetUTF16Length(token.value()), type, modifier});
+    };
+    auto add_variable = [&](const Token& token) {
+      if (variables::GetBuiltinVariables().count(token.value()) != 0) {
+        add(token, GNTokenType::Variable, GNTokenModifier::Builtin);
+      } else if (variables::GetTargetVariables().count(token.value()) != 0) {
+        add(token, GNTokenType::TargetVariable);
+      }
+    };
+    if (const auto* accessor = node->AsAccessor()) {
+      add_variable(accessor->base());
+      AddSemanticTokens(inputs, accessor->subscript(), variable, tokens);
+    } else if (const auto* binary_op = node->AsBinaryOp()) {
+      const auto* identifier = binary_op->left()->AsIdentifier();
+      switch (binary_op->op().type()) {
+        case Token::EQUAL:
+        case Token::PLUS_EQUALS:
+        case Token::MINUS_EQUALS:
+          if (identifier != nullptr) {
+            variable = identifier->value().value();
+          }
+          break;
+        default:
+          break;
+      }
+      AddSemanticTokens(inputs, binary_op->left(), {}, tokens);
+      AddSemanticTokens(inputs, binary_op->right(), variable, tokens);
+    } else if (const auto* block = node->AsBlock()) {
+      for (const auto& statement : block->statements()) {
+        AddSemanticTokens(inputs, statement.get(), {}, tokens);
+      }
+    } else if (const auto* condition = node->AsCondition()) {
+      AddSemanticTokens(inputs, condition->condition(), {}, tokens);
+      AddSemanticTokens(inputs, condition->if_true(), {}, tokens);
+      AddSemanticTokens(inputs, condition->if_false(), {}, tokens);
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      const auto& name = function_call->function();
+      const auto& functions = functions::GetFunctions();
+      auto function = functions.find(name.value());
+      if (function == functions.end()) {
+        add(name, GNTokenType::Function);
+      } else if (function->second.is_target) {
+        add(name, GNTokenType::Target, GNTokenModifier::Builtin);
+      } else {
+        add(name, GNTokenType::Function, GNTokenModifier::Builtin);
+      }
+      // Imports take paths, as the variables of |inputs| do.
+      bool import = name.value() == functions::kImport;
+      AddSemanticTokens(inputs, function_call->args(),
+                        import ? functions::kImport : std::string_view(),
+                        tokens);
+      AddSemanticTokens(inputs, function_call->block(), {}, tokens);
+    } else if (const auto* identifier = node->AsIdentifier()) {
+      add_variable(identifier->value());
+    } else if (const auto* list = node->AsList()) {
+      for (const auto& item : list->contents()) {
+        AddSemanticTokens(inputs, item.get(), variable, tokens);
+      }
+    } else if (const auto* literal = node->AsLiteral()) {
+      const auto& value = literal->value();
+      if (value.type() != Token::STRING || variable.empty()) {
+        return;
+      }
+      if (inputs.labels.count(variable) != 0) {
+        add(value, GNTokenType::Label);
+      } else if (inputs.paths.count(variable) != 0 ||
+                 variable == functions::kImport) {
+        add(value, GNTokenType::Path);
+      }
+    } else if (const auto* unary_op = node->AsUnaryOp()) {
+      AddSemanticTokens(inputs, unary_op->operand(), variable, tokens);
+    }
+  }
+
+  [[nodiscard]] auto MakeScope() const -> GNScope {
+    GNTimer timer(GNPhase::Scope);
+    GNScope scope;
+    std::stack<const ParseNode*> nodes;
+    for (const auto& statement : statements_) {
+      nodes.push(statement.node);
+      while (!nodes.empty()) {
+        const auto* node = nodes.top();
+        nodes.pop();
+        if (node == nullptr) {
+          continue;
+        }
+        if (const auto* block = node->AsBlock()) {
+          for (auto item = block->statements().rbegin();
+               item != block->statements().rend(); item++) {
+            nodes.push(item->get());
+          }
+        } else if (const auto* condition = node->AsCondition()) {
+          nodes.push(condition->if_false());
+          nodes.push(condition->if_true());
+        } else if (const auto* function_call = node->AsFunctionCall()) {
+          if (function_call->block() != nullptr) {
+            scope.declares.push_back({function_call, statement.lines});
+          }
+        }
+      }
+    }
+    for (const auto& statement : statements_) {
+      AddSymbols(scope, statement.node, -1, statement.lines);
+    }
+    return scope;
+  }
+
+  // Nodes from the top-level statement down to the innermost one containing
+  // |location|. Sets |lines| to the lines that statement moved since it was
+  // parsed.
+  auto TraversePath(const Location& location, int* lines) const
+      -> std::vector<const ParseNode*> {
+    std::vector<const ParseNode*> result;
+    const ParseNode* current = nullptr;
+    auto statement = std::partition_point(
+        statements_.begin(), statements_.end(),
+        [&](const GNStatement& statement) {
+          return !(location <
+                   GNShift(statement.node->GetRange().end(), statement.lines));
+        });
+    *lines = statement != statements_.end() ? statement->lines : 0;
+    // Where |location| was when the statement was parsed, as its nodes are.
+    auto parsed = GNShift(location, -*lines);
+    auto contain = [](const LocationRange& range, const Location& location) {
+      return !(location < range.begin()) && (location < range.end());
+    };
+    auto next = [&](const ParseNode* node) {
+      if (node != nullptr && contain(node->GetRange(), parsed)) {
+        result.push_back(node);
+        current = node;
+        return true;
+      }
+      current = nullptr;
+      return false;
+    };
+    // Siblings are ordered and disjoint, so the one containing |location| is
+    // found by bisection, keeping long lists as cheap as short ones.
+    auto bisect = [&](const auto& nodes, auto get) {
+      auto item = std::partition_point(
+          nodes.begin(), nodes.end(), [&](const auto& node) {
+            return !(parsed < get(node)->GetRange().end());
+          });
+      return next(item != nodes.end() ? get(*item) : nullptr);
+    };
+    auto get_owned = [](const auto& node) -> const ParseNode* {
+      return node.get();
+    };
+    next(statement != statements_.end() ? statement->node : nullptr);
+    while (current != nullptr) {
+      if (const auto* accessor = current->AsAccessor()) {
+        next(accessor->subscript()) || next(accessor->member());
+      } else if (const auto* binary_op = current->AsBinaryOp()) {
+        next(binary_op->left()) || next(binary_op->right());
+      } else if (const auto* block = current->AsBlock()) {
+        bisect(block->statements(), get_owned);
+      } else if (const auto* condition = current->AsCondition()) {
+        next(condition->condition()) || next(condition->if_true()) ||
+            next(condition->if_false());
+      } else if (const auto* function_call = current->AsFunctionCall()) {
+        next(function_call->args()) || next(function_call->block());
+      } else if (const auto* list = current->AsList()) {
+        bisect(list->contents(), get_owned);
+      } else if (const auto* unary_op = current->AsUnaryOp()) {
+        next(unary_op->operand());
+      } else {
+        break;
+      }
+    }
+    return result;
+  }
+
+  // Appends the text of expression |node| to |result|, without allocating
+  // beyond growing it.
+  static void AppendExpression(const ParseNode* node, std::string& result) {
+    if (const auto* accessor = node->AsAccessor()) {
+      result.append(accessor->base().value());
+      if (const auto* member = accessor->member()) {
+        // base.member
+        result.append(".").append(member->value().value());
+      } else {
+        // base[subscript]
+        result.append("[");
+        AppendExpression(accessor->subscript(), result);
+        result.append("]");
+      }
+    } else if (const auto* binary_op = node->AsBinaryOp()) {
+      AppendExpression(binary_op->left(), result);
+      result.append(binary_op->op().value());
+      AppendExpression(binary_op->right(), result);
+    } else if (const auto* identifier = node->AsIdentifier()) {
+      result.append(identifier->value().value());
+    } else if (const auto* unary_op = node->AsUnaryOp()) {
+      result.append(unary_op->op().value());
+      AppendExpression(unary_op->operand(), result);
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      result.append(function_call->function().value());
+      AppendExpression(function_call->args(), result);
+    } else if (const auto* list = node->AsList()) {
+      result.append(list->Begin().value());
+      const auto& contents = list->contents();
+      for (size_t i = 0; i != contents.size(); i++) {
+        if (i != 0) {
+          result.append(", ");
+        }
+        AppendExpression(contents[i].get(), result);
+      }
+      AppendExpression(list->End(), result);
+    } else if (const auto* literal = node->AsLiteral()) {
+      result.append(literal->value().value());
+    } else if (const auto* end = node->AsEnd()) {
+      result.append(end->value().value());
+    } else {
+      result.append("UNKNOWN");
+    }
+  }
+
+  // Appends a symbol named after expression |name|, or |text| without one,
+  // returning its index for its children to refer to.
+  static auto AddSymbol(GNScope& scope,
+                        GNSymbolKind kind,
+                        const LocationRange& range,
+                        const LocationRange& selection_range,
+                        int32_t parent,
+                        const ParseNode* name,
+                        std::string_view text = {}) -> int32_t {
+    auto offset = scope.names.size();
+    if (name != nullptr) {
+      AppendExpression(name, scope.names);
+    } else {
+      scope.names.append(text);
+    }
+    auto index = static_cast<int32_t>(scope.symbols.size());
+    scope.symbols.push_back(
+        {kind, range, selection_range, static_cast<uint32_t>(offset),
+         static_cast<uint32_t>(scope.names.size() - offset), parent,
+         static_cast<uint32_t>(index + 1)});
+    return index;
+  }
+
+  // Appends the symbols of statement |node| under |parent|, with the lines
+  // its top-level statement moved.
+  static void AddSymbols(GNScope& scope,
+                         const ParseNode* node,
+                         int32_t parent,
+                         int lines) {
+    if (node == nullptr) {
+      return;
+    }
+    auto range = [lines](const ParseNode* node) {
+      return GNShift(node->GetRange(), lines);
+    };
+    // Closes symbol |index| after its children were added.
+    auto close = [&](int32_t index) {
+      scope.symbols[index].end = static_cast<uint32_t>(scope.symbols.size());
+    };
+
+    // Only handle statement like node.
+    // StatementList = { Statement } .
+    // Statement     = Assignment | Call | Condition .
+    if (const auto* binary_op = node->AsBinaryOp()) {
+      // Assignment  = LValue AssignOp Expr .
+      // AssignOp    = "=" | "+=" | "-=" .
+      switch (binary_op->op().type()) {
+        case Token::EQUAL:
+        case Token::PLUS_EQUALS:
+        case Token::MINUS_EQUALS:
+          AddSymbol(scope, GNSymbolKind::Variable, range(binary_op),
+                    range(binary_op->left()), parent, binary_op->left());
+          break;
+        default:
+          break;
+      }
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      // Call        = identifier "(" [ ExprList ] ")" [ Block ] .
+      LocationRange selection_range =
+          GNShift(function_call->function().range(), lines)
+              .Union(range(function_call->args()));
+      auto index = AddSymbol(scope, GNSymbolKind::Function,
+                             range(function_call), selection_range, parent,
+                             function_call);
+      AddSymbols(scope, function_call->block(), index, lines);
+      close(index);
+    } else if (const auto* condition = node->AsCondition()) {
+      // Condition     = "if" "(" Expr ")" Block
+      //                 [ "else" ( Condition | Block ) ] .
+      auto index = AddSymbol(scope, GNSymbolKind::Boolean, range(condition),
+                             range(condition->condition()), parent,
+                             condition->condition());
+      AddSymbols(scope, condition->if_true(), index, lines);
+      if (const auto* elseNode = condition->if_false(); elseNode != nullptr) {
+        // Explicit add else node.
+        // TODO(linyhe): selection_range for else node.
+        auto elseIndex =
+            AddSymbol(scope, GNSymbolKind::Operator, range(elseNode),
+                      range(elseNode), index, nullptr, "else");
+        AddSymbols(scope, elseNode, elseIndex, lines);
+        close(elseIndex);
+      }
+      close(index);
+    } else if (const auto* block = node->AsBlock()) {
+      // Block        = "{" [ StatementList ] "}" .
+      for (const auto& statement : block->statements()) {
+        AddSymbols(scope, statement.get(), parent, lines);
+      }
+    }
+  }
+
+  std::shared_ptr<const InputFile> file_;
+  base::FilePath root_;
+  std::shared_ptr<const std::string> contents_;
+  std::vector<GNStatement> statements_;
+  Err err_;
+  mutable std::once_flag scope_once_;
+  mutable GNScope scope_;
+  mutable std::once_flag assignments_once_;
+  mutable GNAssignments assignments_;
+};
+
+using GNContent = std::variant<std::string, std::vector<GNEdit>>;
+
+// Finds the root of the project of each directory, the closest one with a .gn
+// file. Answers, including the lack of a root, are kept for every directory
+// probed until a .gn file is created or deleted.
+class GNRoots {
+ public:
+  auto Find(const base::FilePath& directory) -> base::FilePath {
+    std::vector<std::string> probed;
+    base::FilePath root;
+    uint64_t generation = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      generation = generation_;
+    }
+    base::FilePath current = directory;
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto item = roots_.find(current.value());
+        if (item != roots_.end()) {
+          root = item->second;
+          break;
+        }
+      }
+      probed.push_back(current.value());
+      if (base::PathExists(current.Append(FILE_PATH_LITERAL(".gn")))) {
+        root = current;
+        break;
+      }
+      base::FilePath upper = current.StripTrailingSeparators().DirName();
+      if (current == upper) {
+        break;
+      }
+      current = std::move(upper);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Answers probed across an invalidation may be stale.
+    if (generation == generation_) {
+      for (auto& item : probed) {
+        roots_.emplace(std::move(item), root);
+      }
+    }
+    return root;
+  }
+
+  auto Find(const SourceFile& file) -> base::FilePath {
+    return Find(UTF8ToFilePath(file.GetDir().SourceWithNoTrailingSlash()));
+  }
+
+  void Invalidate() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    roots_.clear();
+    generation_++;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, base::FilePath> roots_;
+  uint64_t generation_ = 0;
+};
+
+struct GNDirectoryEntry {
+  std::string name;
+  bool directory = false;
+};
+
+// Lists directories for path completion, each once until something in it is
+// created or deleted.
+class GNDirectories {
+ public:
+  using Entries = std::shared_ptr<const std::vector<GNDirectoryEntry>>;
+
+  // Entries of |directory| sorted by name, none if it does not exist. Listed
+  // again once the directory is modified, as only build files are watched.
+  auto List(const std::string& directory) -> Entries {
+    auto key = GetKey(directory);
+    auto modified = GetModified(key);
+    uint64_t generation = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto item = entries_.find(key);
+      if (item != entries_.end() && item->second.modified == modified) {
+        return item->second.entries;
+      }
+      generation = generation_;
+    }
+    auto entries = std::make_shared<std::vector<GNDirectoryEntry>>();
+    base::FileEnumerator enumerator(
+        UTF8ToFilePath(key), false,
+        base::FileEnumerator::FILES | base::FileEnumerator::DIRECTORIES);
+    for (auto path = enumerator.Next(); !path.empty();
+         path = enumerator.Next()) {
+      entries->push_back({FilePathToUTF8(path.BaseName()),
+                          enumerator.GetInfo().IsDirectory()});
+    }
+    std::sort(entries->begin(), entries->end(),
+              [](const GNDirectoryEntry& a, const GNDirectoryEntry& b) {
+                return a.name < b.name;
+              });
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Kept only when nothing changed while listing.
+    if (generation_ == generation) {
+      entries_[key] = {modified, entries};
+    }
+    return entries;
+  }
+
+  // Forgets the listings that |path| being created or deleted changes: its
+  // parent, and its own and those under it when a directory.
+  void Invalidate(const std::string& path) {
+    auto key = GetKey(path);
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(GetKey(FilePathToUTF8(UTF8ToFilePath(key).DirName())));
+    entries_.erase(key);
+    // Keys under |key| sort between it followed by '/' and by the next
+    // character.
+    entries_.erase(entries_.lower_bound(key + '/'),
+                   entries_.lower_bound(key + static_cast<char>('/' + 1)));
+    generation_++;
+  }
+
+ private:
+  static auto GetKey(const std::string& path) -> std::string {
+    return FilePathToUTF8(UTF8ToFilePath(path)
+                              .StripTrailingSeparators()
+                              .NormalizePathSeparatorsTo('/'));
+  }
+
+  // Modification time of directory |key|, or nothing if it does not exist.
+  static auto GetModified(const std::string& key) -> std::optional<int64_t> {
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(
+        std::filesystem::path(UTF8ToFilePath(key).value()), error);
+    if (error) {
+      return std::nullopt;
+    }
+    return static_cast<int64_t>(modified.time_since_epoch().count());
+  }
+
+  struct Listing {
+    std::optional<int64_t> modified;
+    Entries entries;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, Listing> entries_;
+  uint64_t generation_ = 0;
+};
+
+class GNDocument {
+ public:
+  // |root| is the root of the project of |file|, or empty. The bytes held
+  // count in |memory|, if any.
+  GNDocument(const std::string& file,
+             base::FilePath root,
+             std::shared_ptr<GNMemory> memory = nullptr)
+      : file_(std::make_shared<InputFile>(SourceFile(file))),
+        root_(std::move(root)),
+        contents_(std::make_shared<const std::string>()),
+        snapshot_(MakeSnapshot()),
+        memory_(std::move(memory)) {}
+  ~GNDocument() { SetStats({}); }
+  GNDocument(const GNDocument&) = delete;
+  GNDocument(GNDocument&&) = delete;
+  auto operator=(const GNDocument&) -> GNDocument& = delete;
+  auto operator=(GNDocument&&) -> GNDocument& = delete;
+
+  // Reserves a turn to update the content, on the JS thread. Updates are
+  // applied in the order of their turns, whichever thread runs them.
+  auto Reserve() -> uint64_t { return reserved_++; }
+
+  [[nodiscard]] auto GetRoot() const -> const base::FilePath& { return root_; }
+
+  // Version including all reserved updates, on the JS thread.
+  [[nodiscard]] auto GetVersion() const -> uint64_t { return reserved_; }
+
+  auto UpdateContent(uint64_t turn, GNContent content) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      turn_.wait(lock, [&] { return version_ == turn; });
+    }
+    // Holding the turn, no other update touches the editing state.
+    if (auto* text = std::get_if<std::string>(&content)) {
+      SetContent(std::move(*text));
+    } else {
+      if (evicted_) {
+        // Kept alive, as setting the content replaces |contents_|.
+        auto contents = contents_;
+        SetContent(*contents);
+      }
+      EditContent(std::get<std::vector<GNEdit>>(content));
+    }
+    evicted_ = false;
+    auto snapshot = MakeSnapshot();
+    auto stats = MakeStats();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      snapshot_ = std::move(snapshot);
+      evicted_contents_ = nullptr;
+      SetStats(stats);
+      version_++;
+    }
+    turn_.notify_all();
+  }
+
+  auto UpdateContent(GNContent content) {
+    UpdateContent(Reserve(), std::move(content));
+  }
+
+  // Waits for the updates before |version| and returns the resulting state.
+  auto GetSnapshot(uint64_t version) -> std::shared_ptr<const GNSnapshot> {
+    std::unique_lock<std::mutex> lock(mutex_);
+    turn_.wait(lock, [&] { return version_ >= version; });
+    if (snapshot_ != nullptr) {
+      return snapshot_;
+    }
+    // Evicted, parse the content again apart from the editing state, which an
+    // update may be using.
+    auto contents = evicted_contents_;
+    auto current = version_;
+    lock.unlock();
+    GNDocument document(file_->name().value(), root_);
+    document.UpdateContent(*contents);
+    auto snapshot = document.GetSnapshot();
+    auto stats = document.GetStats();
+    lock.lock();
+    if (snapshot_ == nullptr && version_ == current) {
+      snapshot_ = snapshot;
+      SetStats(stats);
+    }
+    return snapshot;
+  }
+
+  auto GetSnapshot() -> std::shared_ptr<const GNSnapshot> {
+    return GetSnapshot(GetVersion());
+  }
+
+  // Sizes as of the last update done.
+  auto GetStats() -> GNDocumentStats {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  // Drops the tokens and parse tree to keep only the content, on the JS
+  // thread. They are built again when needed. Fails while updates are pending
+  // or when there is nothing to drop.
+  auto Evict() -> bool {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version_ != reserved_ || (evicted_ && snapshot_ == nullptr)) {
+      return false;
+    }
+    // No update runs until the next turn is reserved, on this thread.
+    tokens_ = {};
+    shift_ = {};
+    statements_ = {};
+    parsed_ = false;
+    evicted_ = true;
+    evicted_contents_ = contents_;
+    snapshot_ = nullptr;
+    SetStats({stats_.bytes, 0, 0});
+    return true;
+  }
+
+ private:
+  // Token of |contents_| by offset, so that the ones before an edit stay
+  // valid as the content is replaced.
+  struct GNToken {
+    size_t offset = 0;
+    size_t size = 0;
+    Token::Type type = Token::INVALID;
+    int line = 0;
+    int column = 0;
+  };
+  // Move of the tokens from |token| on not applied yet, so that an edit only
+  // updates the tokens between it and the previous one.
+  struct GNTokenShift {
+    size_t token = 0;
+    ptrdiff_t bytes = 0;
+    int lines = 0;
+  };
+
+  // Replaces the sizes, and their part of the memory counted. Called with
+  // |mutex_| held, or when destroyed.
+  void SetStats(const GNDocumentStats& stats) {
+    if (memory_ != nullptr) {
+      *memory_ += stats.bytes + stats.tree_bytes;
+      *memory_ -= stats_.bytes + stats_.tree_bytes;
+    }
+    stats_ = stats;
+  }
+
+  void SetContent(std::string content) {
+    // Moved into the input file tokenized in place, which the content then
+    // points into.
+    auto input = std::make_shared<InputFile>(file_->name());
+    input->SetContents(std::exchange(content, std::string()));
+    contents_ = std::shared_ptr<const std::string>(input, &input->contents());
+    const auto& text = *contents_;
+    lines_.assign(1, 0);
+    for (size_t i = 0; i < text.size(); i++) {
+      if (text[i] == '\n') {
+        lines_.push_back(i + 1);
+      }
+    }
+    Err err;
+    tokens_ = Tokenize(*input, 0, &err);
+    shift_ = {};
+    tokenized_ = !err.has_error();
+    parsed_ = false;
+    if (tokenized_) {
+      err = UpdateStatements(0, 0, 0, 0);
+    }
+    err_ = err;
+  }
+
+  void EditContent(const std::vector<GNEdit>& edits) {
+    // Count of leading and trailing tokens left untouched by all edits, and
+    // how many lines the trailing ones moved.
+    size_t count = tokens_.size();
+    size_t prefix = count;
+    size_t suffix = count;
+    int lines = 0;
+    Err err;
+    for (const auto& edit : edits) {
+      size_t begin = GetOffset(edit.begin);
+      size_t end = std::max(begin, GetOffset(edit.end));
+      if (!tokenized_) {
+        ReplaceContent(begin, end, edit.text);
+        continue;
+      }
+      // Re-tokenize whole lines around the edit. Comment tokens are classified
+      // by their neighbours, so also take in adjacent comments until the
+      // damaged span is bounded by other tokens on both sides.
+      size_t span_begin = lines_[GetLineIndex(begin)];
+      size_t first = LowerToken(span_begin);
+      while (first > 0 && IsComment(tokens_[first - 1].type)) {
+        span_begin = lines_[GetLineIndex(GetToken(first - 1).offset)];
+        first = LowerToken(span_begin);
+      }
+      size_t line = GetLineIndex(end) + 1;
+      size_t last = LowerToken(line < lines_.size() ? lines_[line]
+                                                    : contents_->size());
+      while (last < tokens_.size() && IsComment(tokens_[last].type)) {
+        last++;
+      }
+      size_t span_end = last < tokens_.size()
+                            ? lines_[GetLineIndex(GetToken(last).offset)]
+                            : contents_->size();
+
+      auto line_count = static_cast<int>(lines_.size());
+      ReplaceContent(begin, end, edit.text);
+      auto shift = static_cast<ptrdiff_t>(edit.text.size()) -
+                   static_cast<ptrdiff_t>(end - begin);
+      auto line_shift = static_cast<int>(lines_.size()) - line_count;
+      auto span = TokenizeSpan(span_begin, span_end + shift, &err);
+      if (err.has_error()) {
+        tokenized_ = false;
+        continue;
+      }
+
+      // Splices the span in place of the tokens it replaces. The ones before
+      // are unchanged, and the ones after move by the pending shift, which is
+      // only applied to the tokens between this edit and the previous one.
+      MoveShift(last);
+      auto replaced = static_cast<ptrdiff_t>(last - first);
+      auto added = static_cast<ptrdiff_t>(span.size());
+      auto at = tokens_.begin() + static_cast<ptrdiff_t>(first);
+      std::copy(span.begin(), span.begin() + std::min(replaced, added), at);
+      if (added < replaced) {
+        tokens_.erase(at + added, at + replaced);
+      } else {
+        tokens_.insert(at + replaced, span.begin() + replaced, span.end());
+      }
+      shift_ = {first + span.size(), shift_.bytes + shift,
+                shift_.lines + line_shift};
+      prefix = std::min(prefix, first);
+      suffix = std::min(suffix, tokens_.size() - first - span.size());
+      lines += line_shift;
+    }
+    if (!tokenized_) {
+      // Some edit broke tokenization, start over from the full content.
+      err = Err();
+      tokens_ = TokenizeSpan(0, contents_->size(), &err);
+      shift_ = {};
+      tokenized_ = !err.has_error();
+      parsed_ = false;
+    }
+    if (tokenized_) {
+      err = UpdateStatements(count, prefix, suffix, lines);
+    }
+    err_ = err;
+  }
+
+  static auto IsComment(Token::Type type) -> bool {
+    switch (type) {
+      case Token::LINE_COMMENT:
+      case Token::SUFFIX_COMMENT:
+      case Token::BLOCK_COMMENT:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Token |index| as of the current content.
+  auto GetToken(size_t index) const -> GNToken {
+    auto token = tokens_[index];
+    if (index >= shift_.token) {
+      token.offset += static_cast<size_t>(shift_.bytes);
+      token.line += shift_.lines;
+    }
+    return token;
+  }
+
+  // Makes the pending shift start at token |index|, applying it to the tokens
+  // before, or taking it off the ones from there on.
+  void MoveShift(size_t index) {
+    if (shift_.bytes == 0 && shift_.lines == 0) {
+      shift_.token = index;
+      return;
+    }
+    for (size_t i = shift_.token; i < index; i++) {
+      tokens_[i].offset += static_cast<size_t>(shift_.bytes);
+      tokens_[i].line += shift_.lines;
+    }
+    for (size_t i = index; i < shift_.token; i++) {
+      tokens_[i].offset -= static_cast<size_t>(shift_.bytes);
+      tokens_[i].line -= shift_.lines;
+    }
+    shift_.token = index;
+  }
+
+  auto GetOffset(const GNPosition& position) const -> size_t {
+    if (position.line < 1) {
+      return 0;
+    }
+    if (static_cast<size_t>(position.line) > lines_.size()) {
+      return contents_->size();
+    }
+    // Lead bytes below these start 1, 2 and 3 byte UTF-8 sequences. Longer
+    // ones take a surrogate pair in UTF-16.
+    constexpr unsigned char kOneByte = 0x80;
+    constexpr unsigned char kTwoBytes = 0xE0;
+    constexpr unsigned char kThreeBytes = 0xF0;
+    const auto& contents = *contents_;
+    size_t offset = lines_[position.line - 1];
+    int column = 1;
+    while (column < position.column && offset < contents.size() &&
+           contents[offset] != '\n') {
+      auto byte = static_cast<unsigned char>(contents[offset]);
+      size_t length = byte < kOneByte      ? 1
+                      : byte < kTwoBytes   ? 2
+                      : byte < kThreeBytes ? 3
+                                           : 4;
+      column += length == 4 ? 2 : 1;
+      offset = std::min(offset + length, contents.size());
+    }
+    return offset;
+  }
+
+  auto GetLineIndex(size_t offset) const -> size_t {
+    return std::upper_bound(lines_.begin(), lines_.end(), offset) -
+           lines_.begin() - 1;
+  }
+
+  // Index of the first token in [begin, end) for which |before| is false,
+  // when it holds for the ones before it.
+  template <typename F>
+  auto PartitionTokens(size_t begin, size_t end, F before) const -> size_t {
+    while (begin < end) {
+      auto middle = begin + (end - begin) / 2;
+      if (before(GetToken(middle))) {
+        begin = middle + 1;
+      } else {
+        end = middle;
+      }
+    }
+    return begin;
+  }
+
+  // Index of the first token starting at or after |offset|.
+  auto LowerToken(size_t offset) const -> size_t {
+    return PartitionTokens(0, tokens_.size(), [&](const GNToken& token) {
+      return token.offset < offset;
+    });
+  }
+
+  // Replaces the bytes in [begin, end).
+  void ReplaceContent(size_t begin, size_t end, const std::string& text) {
+    std::string contents;
+    contents.reserve(contents_->size() - (end - begin) + text.size());
+    contents.append(*contents_, 0, begin)
+        .append(text)
+        .append(*contents_, end, std::string::npos);
+    std::vector<size_t> lines;
+    for (size_t i = 0; i < text.size(); i++) {
+      if (text[i] == '\n') {
+        lines.push_back(begin + i + 1);
+      }
+    }
+    auto first = std::upper_bound(lines_.begin(), lines_.end(), begin);
+    auto last = std::upper_bound(first, lines_.end(), end);
+    for (auto line = last; line != lines_.end(); line++) {
+      *line = *line - (end - begin) + text.size();
+    }
+    lines_.insert(lines_.erase(first, last), lines.begin(), lines.end());
+    contents_ = std::make_shared<const std::string>(std::move(contents));
+  }
+
+  // Tokenizes the content in [begin, end), where |begin| is a line start.
+  auto TokenizeSpan(size_t begin, size_t end, Err* err)
+      -> std::vector<GNToken> {
+    InputFile input(file_->name());
+    input.SetContents(contents_->substr(begin, end - begin));
+    return Tokenize(input, begin, err);
+  }
+
+  // Tokenizes |input|, the content from |begin| on, which is a line start.
+  auto Tokenize(const InputFile& input, size_t begin, Err* err)
+      -> std::vector<GNToken> {
+    GNTimer timer(GNPhase::Tokenize);
+    auto line = static_cast<int>(GetLineIndex(begin));
+    auto relocate = [&](const Location& location) {
+      return location.file() != nullptr
+                 ? Location(file_.get(), location.line_number() + line,
+                            location.column_number())
+                 : Location();
+    };
+    Err input_err;
+    auto tokens = Tokenizer::Tokenize(&input, &input_err);
+    if (input_err.has_error()) {
+      *err = Err(relocate(input_err.location()), input_err.message(),
+                 input_err.help_text());
+      for (const auto& range : input_err.ranges()) {
+        err->AppendRange(
+            LocationRange(relocate(range.begin()), relocate(range.end())));
+      }
+      return {};
+    }
+    const char* base = input.contents().data();
+    std::vector<GNToken> result;
+    result.reserve(tokens.size());
+    for (const auto& token : tokens) {
+      const auto& location = token.location();
+      result.push_back({begin + (token.value().data() - base),
+                        token.value().size(), token.type(),
+                        location.line_number() + line,
+                        location.column_number()});
+    }
+    return result;
+  }
+
+  // Parses the tokens in [begin, end), which start at a statement boundary.
+  auto ParseStatements(size_t begin, size_t end, Err* err)
+      -> std::vector<GNStatement> {
+    GNTimer timer(GNPhase::Parse);
+    auto chunk = std::make_shared<GNChunk>();
+    std::string_view contents;
+    size_t base = 0;
+    if (begin == 0 && end == tokens_.size()) {
+      // Shares the content, which no edit changes in place.
+      chunk->contents = contents_;
+      contents = *contents_;
+    } else if (begin != end) {
+      auto back = GetToken(end - 1);
+      base = GetToken(begin).offset;
+      chunk->contents = std::make_shared<std::string>(
+          std::string_view(*contents_).substr(base,
+                                              back.offset + back.size - base));
+      contents = *chunk->contents;
+    }
+    std::vector<Token> tokens;
+    tokens.reserve(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      auto token = GetToken(i);
+      tokens.emplace_back(Location(file_.get(), token.line, token.column),
+                          token.type,
+                          contents.substr(token.offset - base, token.size));
+    }
+    chunk->node = Parser::Parse(tokens, err);
+    std::vector<GNStatement> result;
+    if (err->has_error()) {
+      return result;
+    }
+    size_t token = begin;
+    for (const auto& statement : chunk->node->AsBlock()->statements()) {
+      auto location = statement->GetRange().begin();
+      token = PartitionTokens(token, end, [&](const GNToken& item) {
+        return std::tie(item.line, item.column) <
+               std::make_tuple(location.line_number(),
+                               location.column_number());
+      });
+      result.push_back({chunk, statement.get(), token});
+    }
+    return result;
+  }
+
+  // Re-parses the statements touched since the last parse. Of the |count|
+  // previous tokens, |prefix| leading and |suffix| trailing ones are unchanged
+  // and the trailing ones moved down by |lines| lines.
+  auto UpdateStatements(size_t count, size_t prefix, size_t suffix, int lines)
+      -> Err {
+    // Statements own the tokens up to the next statement, so a statement is
+    // kept when all of these are unchanged. Statements after the edits keep
+    // their nodes, and count the lines they moved instead.
+    size_t head = 0;
+    size_t tail = statements_.size();
+    if (parsed_) {
+      auto next = [&](size_t index) {
+        return index + 1 < statements_.size() ? statements_[index + 1].token
+                                               : count;
+      };
+      while (head < statements_.size() && next(head) <= prefix) {
+        head++;
+      }
+      while (tail > head && statements_[tail - 1].token >= count - suffix) {
+        tail--;
+      }
+    }
+    auto offset = static_cast<ptrdiff_t>(tokens_.size()) -
+                  static_cast<ptrdiff_t>(count);
+    size_t begin = head == 0 ? 0
+                   : head < statements_.size() ? statements_[head].token
+                                               : count;
+    size_t end = tail < statements_.size()
+                     ? statements_[tail].token + offset
+                     : tokens_.size();
+    Err err;
+    auto statements = ParseStatements(begin, end, &err);
+    if (err.has_error() && (begin != 0 || end != tokens_.size())) {
+      // Kept statements can swallow the tokens after them in a full parse,
+      // e.g. a call that gains a block. Fall back to parse everything.
+      err = Err();
+      head = 0;
+      tail = statements_.size();
+      statements = ParseStatements(0, tokens_.size(), &err);
+    }
+    parsed_ = !err.has_error();
+    if (!parsed_) {
+      return err;
+    }
+    statements.insert(statements.begin(),
+                      std::make_move_iterator(statements_.begin()),
+                      std::make_move_iterator(statements_.begin() +
+                                              static_cast<ptrdiff_t>(head)));
+    for (size_t i = tail; i < statements_.size(); i++) {
+      auto& statement = statements.emplace_back(std::move(statements_[i]));
+      statement.token += offset;
+      statement.lines += lines;
+    }
+    statements_ = std::move(statements);
+    return err;
+  }
+
+  auto MakeSnapshot() const -> std::shared_ptr<const GNSnapshot> {
+    return std::make_shared<const GNSnapshot>(file_, root_, contents_,
+                                              statements_, err_);
+  }
+
+  auto MakeStats() const -> GNDocumentStats {
+    // Roughly what gn allocates per token, most of which become a node.
+    constexpr size_t kNodeBytes = sizeof(Token) + 64;
+    GNDocumentStats stats{contents_->size(), tokens_.size(), 0};
+    const GNChunk* chunk = nullptr;
+    for (const auto& statement : statements_) {
+      // Not counting the current content again.
+      if (statement.chunk.get() != chunk &&
+          statement.chunk->contents != contents_) {
+        chunk = statement.chunk.get();
+        stats.tree_bytes += chunk->contents->size();
+      }
+    }
+    stats.tree_bytes += tokens_.size() * kNodeBytes;
+    return stats;
+  }
+
+  std::shared_ptr<InputFile> file_;
+  base::FilePath root_;
+  // Editing state, only touched by the update holding the turn.
+  Err err_;
+  std::shared_ptr<const std::string> contents_;
+  // Offset of the first byte of each line in |contents_|.
+  std::vector<size_t> lines_ = {0};
+  // Tokens of |contents_|, valid when |tokenized_|, as moved by |shift_|.
+  std::vector<GNToken> tokens_;
+  GNTokenShift shift_;
+  bool tokenized_ = true;
+  // Top-level statements of the last successful parse, which matches
+  // |tokens_| when |parsed_|.
+  std::vector<GNStatement> statements_;
+  bool parsed_ = false;
+  // Whether tokens and statements were dropped to save memory.
+  bool evicted_ = false;
+  // Turns reserved on the JS thread.
+  uint64_t reserved_ = 0;
+  std::mutex mutex_;
+  std::condition_variable turn_;
+  // Turns done and the resulting state, guarded by |mutex_|.
+  uint64_t version_ = 0;
+  std::shared_ptr<const GNSnapshot> snapshot_;
+  // Content to parse again while evicted, when |snapshot_| is null.
+  std::shared_ptr<const std::string> evicted_contents_;
+  GNDocumentStats stats_;
+  std::shared_ptr<GNMemory> memory_;
+};
+
+// Fixed set of threads running posted tasks in order, started on first use.
+// Tasks not started yet are dropped on destruction.
+class GNThreadPool {
+ public:
+  GNThreadPool() = default;
+  ~GNThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+  GNThreadPool(const GNThreadPool&) = delete;
+  GNThreadPool(GNThreadPool&&) = delete;
+  auto operator=(const GNThreadPool&) -> GNThreadPool& = delete;
+  auto operator=(GNThreadPool&&) -> GNThreadPool& = delete;
+
+  static auto GetSize() -> unsigned {
+    return std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  void Post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+      if (threads_.empty()) {
+        for (unsigned i = 0; i < GetSize(); i++) {
+          threads_.emplace_back([this] { Run(); });
+        }
+      }
+    }
+    ready_.notify_one();
+  }
+
+  // Runs |work| for each index below |count| on the calling thread and on
+  // pool threads, each taking the next index when free. Returns when all are
+  // done, even if the pool never gets to them.
+  void ForEach(size_t count, const std::function<void(size_t)>& work) {
+    struct State {
+      std::atomic<size_t> next = 0;
+      std::mutex mutex;
+      std::condition_variable idle;
+      size_t active = 0;
+      bool closed = false;
+    };
+    auto state = std::make_shared<State>();
+    auto run = [state, count, &work] {
+      for (auto index = state->next++; index < count; index = state->next++) {
+        work(index);
+      }
+    };
+    auto helpers = std::min<size_t>(count, GetSize()) - (count > 0 ? 1 : 0);
+    for (size_t i = 0; i < helpers; i++) {
+      Post([state, run] {
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          if (state->closed) {
+            return;
+          }
+          state->active++;
+        }
+        run();
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          state->active--;
+        }
+        state->idle.notify_all();
+      });
+    }
+    run();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    state->idle.wait(lock, [&state] { return state->active == 0; });
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (stopping_) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// Size, modification time and contents hash of a file whose entry is indexed.
+struct GNFileStamp {
+  uint64_t size = 0;
+  int64_t modified = 0;
+  // Zero until the contents are read.
+  uint64_t hash = 0;
+
+  // Gets the stamp of |path|, without the hash, or nothing if not a file.
+  static auto Get(const base::FilePath& path) -> std::optional<GNFileStamp> {
+    std::error_code error;
+    std::filesystem::path file(path.value());
+    auto size = std::filesystem::file_size(file, error);
+    if (error) {
+      return std::nullopt;
+    }
+    auto modified = std::filesystem::last_write_time(file, error);
+    if (error) {
+      return std::nullopt;
+    }
+    return GNFileStamp{size,
+                       static_cast<int64_t>(
+                           modified.time_since_epoch().count()),
+                       0};
+  }
+
+  // FNV-1a, stable across runs unlike std::hash.
+  static auto Hash(std::string_view contents) -> uint64_t {
+    constexpr uint64_t kOffset = 14695981039346656037ULL;
+    constexpr uint64_t kPrime = 1099511628211ULL;
+    uint64_t result = kOffset;
+    for (auto c : contents) {
+      result = (result ^ static_cast<unsigned char>(c)) * kPrime;
+    }
+    // Zero means no hash.
+    return result != 0 ? result : 1;
+  }
+};
+
+// Index entry as of the file state of |stamp|.
+struct GNStampedEntry {
+  GNFileStamp stamp;
+  std::shared_ptr<const GNIndexEntry> entry;
+};
+
+// Index entries saved in a file between sessions, so that a cold start does
+// not parse again the files that did not change. The file is read whole on
+// first use, and each entry is decoded when found still valid for its file.
+class GNIndexCache {
+ public:
+  // Changes with the format, and with what entries hold.
+  static constexpr uint32_t kVersion = 2;
+
+  GNIndexCache() = default;
+  ~GNIndexCache() = default;
+  GNIndexCache(const GNIndexCache&) = delete;
+  GNIndexCache(GNIndexCache&&) = delete;
+  auto operator=(const GNIndexCache&) -> GNIndexCache& = delete;
+  auto operator=(GNIndexCache&&) -> GNIndexCache& = delete;
+
+  // Reads from and saves to |path|, or nowhere if empty.
+  void SetPath(const base::FilePath& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    path_ = path;
+    read_ = false;
+    data_.clear();
+    records_.clear();
+  }
+
+  // Gets the saved entry of |key| if still valid for |stamp|: of the same
+  // size, and modified at the same time or, once |stamp| has a hash, with the
+  // same contents. Then gives |stamp| the saved hash.
+  auto Find(const std::string& key, GNFileStamp& stamp)
+      -> std::shared_ptr<const GNIndexEntry> {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Read();
+    auto item = records_.find(key);
+    if (item == records_.end()) {
+      return nullptr;
+    }
+    const auto& saved = item->second.stamp;
+    if (saved.size != stamp.size ||
+        (saved.modified != stamp.modified &&
+         (stamp.hash == 0 || saved.hash != stamp.hash))) {
+      return nullptr;
+    }
+    GNReader reader{item->second.data};
+    auto entry = Decode(key, reader);
+    if (entry != nullptr) {
+      stamp.hash = saved.hash;
+    }
+    // Kept, for loads racing each other to find it too.
+    return entry;
+  }
+
+  // Replaces the file with |entries|, keeping the entries saved for other
+  // files that were not found yet.
+  void Save(const std::vector<GNStampedEntry>& entries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path_.empty()) {
+      return;
+    }
+    Read();
+    std::string data(kMagic);
+    Write(data, kVersion);
+    auto count = data.size();
+    Write(data, uint32_t{0});
+    std::set<std::string_view> keys;
+    for (const auto& [stamp, entry] : entries) {
+      keys.insert(entry->file);
+      Write(data, entry->file);
+      Write(data, stamp);
+      // Patched once the length is known.
+      auto length = data.size();
+      Write(data, uint32_t{0});
+      Encode(data, *entry);
+      auto size =
+          static_cast<uint32_t>(data.size() - length - sizeof(uint32_t));
+      std::memcpy(&data[length], &size, sizeof(size));
+    }
+    auto records = static_cast<uint32_t>(entries.size());
+    for (const auto& [key, record] : records_) {
+      if (keys.count(key) == 0) {
+        Write(data, key);
+        Write(data, record.stamp);
+        Write(data, record.data);
+        records++;
+      }
+    }
+    std::memcpy(&data[count], &records, sizeof(records));
+    if (data.size() > std::numeric_limits<int>::max()) {
+      return;
+    }
+    base::CreateDirectory(path_.DirName());
+    base::WriteFile(path_, data.data(), static_cast<int>(data.size()));
+  }
+
+ private:
+  static constexpr std::string_view kMagic = "GNLS";
+
+  struct GNRecord {
+    GNFileStamp stamp;
+    std::string_view data;
+  };
+
+  // Reads values in order, failing from the first one past the end.
+  struct GNReader {
+    std::string_view data;
+    bool failed = false;
+
+    template <typename T>
+    auto Read() -> T {
+      T result{};
+      if (failed || data.size() < sizeof(T)) {
+        failed = true;
+        return result;
+      }
+      std::memcpy(&result, data.data(), sizeof(T));
+      data.remove_prefix(sizeof(T));
+      return result;
+    }
+
+    auto ReadString() -> std::string_view {
+      auto size = Read<uint32_t>();
+      if (failed || data.size() < size) {
+        failed = true;
+        return {};
+      }
+      auto result = data.substr(0, size);
+      data.remove_prefix(size);
+      return result;
+    }
+  };
+
+  // Numbers are written as in memory, the file staying on the same machine.
+  template <typename T>
+  static void Write(std::string& data, T value) {
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  static void Write(std::string& data, std::string_view value) {
+    Write(data, static_cast<uint32_t>(value.size()));
+    data.append(value);
+  }
+
+  static void Write(std::string& data, const std::string& value) {
+    Write(data, std::string_view(value));
+  }
+
+  static void Write(std::string& data, const GNFileStamp& stamp) {
+    Write(data, stamp.size);
+    Write(data, stamp.modified);
+    Write(data, stamp.hash);
+  }
+
+  static void Encode(std::string& data, const GNRange& range) {
+    Write(data, static_cast<int32_t>(range.line));
+    Write(data, static_cast<int32_t>(range.column));
+    Write(data, static_cast<int32_t>(range.end_line));
+    Write(data, static_cast<int32_t>(range.end_column));
+  }
+
+  static void Encode(std::string& data,
+                     const std::vector<GNDeclaration>& declarations) {
+    Write(data, static_cast<uint32_t>(declarations.size()));
+    for (const auto& declaration : declarations) {
+      Write(data, declaration.function);
+      Write(data, declaration.name);
+      Encode(data, GNRange{declaration.line, declaration.column,
+                           declaration.end_line, declaration.end_column});
+    }
+  }
+
+  static void Encode(std::string& data, const GNIndexEntry& entry) {
+    Encode(data, entry.declarations);
+    Write(data, static_cast<uint32_t>(entry.imports.size()));
+    for (const auto& import : entry.imports) {
+      Write(data, import);
+    }
+    Encode(data, entry.variables);
+    Write(data, static_cast<uint32_t>(entry.references.size()));
+    for (const auto& [name, ranges] : entry.references) {
+      Write(data, name);
+      Write(data, static_cast<uint32_t>(ranges.size()));
+      for (const auto& range : ranges) {
+        Encode(data, range);
+      }
+    }
+    Write(data, static_cast<uint32_t>(entry.dependencies.size()));
+    for (const auto& dependency : entry.dependencies) {
+      Write(data, static_cast<uint32_t>(dependency.declaration));
+      Write(data, dependency.label);
+      Encode(data, dependency.range);
+    }
+  }
+
+  static auto DecodeRange(GNReader& reader) -> GNRange {
+    GNRange range;
+    range.line = reader.Read<int32_t>();
+    range.column = reader.Read<int32_t>();
+    range.end_line = reader.Read<int32_t>();
+    range.end_column = reader.Read<int32_t>();
+    return range;
+  }
+
+  static void DecodeDeclarations(GNReader& reader,
+                                 std::vector<GNDeclaration>& declarations) {
+    auto count = reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < count && !reader.failed; i++) {
+      auto function = reader.ReadString();
+      auto name = reader.ReadString();
+      auto range = DecodeRange(reader);
+      declarations.push_back({std::string(function), std::string(name),
+                              range.line, range.column, range.end_line,
+                              range.end_column});
+    }
+  }
+
+  // Gets the entry of |key| read by |reader|, or null if corrupt.
+  static auto Decode(const std::string& key, GNReader& reader)
+      -> std::shared_ptr<const GNIndexEntry> {
+    auto entry = std::make_shared<GNIndexEntry>();
+    entry->file = key;
+    DecodeDeclarations(reader, entry->declarations);
+    for (size_t i = 0; i < entry->declarations.size(); i++) {
+      entry->labels.emplace(entry->declarations[i].name, i);
+    }
+    auto imports = reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < imports && !reader.failed; i++) {
+      entry->imports.emplace_back(reader.ReadString());
+    }
+    DecodeDeclarations(reader, entry->variables);
+    auto references = reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < references && !reader.failed; i++) {
+      auto& ranges = entry->references[std::string(reader.ReadString())];
+      auto count = reader.Read<uint32_t>();
+      for (uint32_t j = 0; j < count && !reader.failed; j++) {
+        ranges.push_back(DecodeRange(reader));
+      }
+    }
+    auto dependencies = reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < dependencies && !reader.failed; i++) {
+      GNDependency dependency;
+      dependency.declaration = reader.Read<uint32_t>();
+      dependency.label = reader.ReadString();
+      dependency.range = DecodeRange(reader);
+      if (dependency.declaration >= entry->declarations.size()) {
+        return nullptr;
+      }
+      entry->dependencies.push_back(std::move(dependency));
+    }
+    if (reader.failed || !reader.data.empty()) {
+      return nullptr;
+    }
+    entry->SortPositions();
+    return entry;
+  }
+
+  // Reads the file on first use, keeping nothing unless whole and of this
+  // version. Called with |mutex_| held.
+  void Read() {
+    if (read_) {
+      return;
+    }
+    read_ = true;
+    if (path_.empty() || !base::ReadFileToString(path_, &data_)) {
+      return;
+    }
+    GNReader reader{data_};
+    if (reader.data.substr(0, kMagic.size()) != kMagic) {
+      data_.clear();
+      return;
+    }
+    reader.data.remove_prefix(kMagic.size());
+    if (reader.Read<uint32_t>() != kVersion) {
+      data_.clear();
+      return;
+    }
+    auto count = reader.Read<uint32_t>();
+    std::unordered_map<std::string, GNRecord> records;
+    for (uint32_t i = 0; i < count && !reader.failed; i++) {
+      auto key = reader.ReadString();
+      GNRecord record;
+      record.stamp.size = reader.Read<uint64_t>();
+      record.stamp.modified = reader.Read<int64_t>();
+      record.stamp.hash = reader.Read<uint64_t>();
+      record.data = reader.ReadString();
+      records.emplace(key, record);
+    }
+    if (reader.failed) {
+      data_.clear();
+      return;
+    }
+    records_ = std::move(records);
+  }
+
+  std::mutex mutex_;
+  base::FilePath path_;
+  bool read_ = false;
+  // The file, and the encoded entries in it not decoded yet.
+  std::string data_;
+  std::unordered_map<std::string, GNRecord> records_;
+};
+
+// Labels declared by the build files under the roots of open documents. The
+// files are crawled in the background, and their entries are kept current
+// with open documents and with changes on disk reported by the client.
+class GNIndex {
+ public:
+  // |roots| make labels source-absolute.
+  explicit GNIndex(std::shared_ptr<GNRoots> roots) : roots_(std::move(roots)) {}
+  ~GNIndex() = default;
+  GNIndex(const GNIndex&) = delete;
+  GNIndex(GNIndex&&) = delete;
+  auto operator=(const GNIndex&) -> GNIndex& = delete;
+  auto operator=(GNIndex&&) -> GNIndex& = delete;
+
+  // Starts indexing the files under |root|, once per root.
+  void Crawl(const base::FilePath& root) {
+    if (root.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!crawled_.insert(root.value()).second) {
+        return;
+      }
+    }
+    pool_.Post([this, root] { CrawlDirectory(root, 0); });
+  }
+
+  // Starts entries from those saved in the cache file |path|, when their
+  // files did not change since.
+  void SetCache(const base::FilePath& path) { cache_.SetPath(path); }
+
+  // Saves the entries of the files not open to the cache file, if any
+  // changed since last time.
+  void Save() {
+    std::vector<GNStampedEntry> entries;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (saved_ == generation_) {
+        return;
+      }
+      saved_ = generation_;
+      for (const auto& [key, stamp] : stamps_) {
+        if (open_.count(key) == 0) {
+          entries.push_back({stamp, entries_[key]});
+        }
+      }
+    }
+    cache_.Save(entries);
+  }
+
+  // From now on, the entry of |file| only follows updates of |document|.
+  void Open(const std::string& file, const GNDocument* document) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_[GetKey(file)] = {document, 0, nullptr, 0};
+  }
+
+  // Schedules refreshing the entry of the open |file| from its |version| in
+  // |document|, on the pool. Updates made meanwhile are refreshed together,
+  // and lookups refresh the entries they need first. Updates finishing out of
+  // order do not replace newer ones.
+  void Update(const std::string& file,
+              const GNDocument* document,
+              uint64_t version,
+              std::shared_ptr<const GNSnapshot> snapshot) {
+    auto key = GetKey(file);
+    if (!IsIndexed(key)) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto item = open_.find(key);
+    if (item == open_.end() || item->second.document != document ||
+        item->second.version >= version ||
+        item->second.pending_version >= version) {
+      return;
+    }
+    // Otherwise a refresh is already on its way.
+    bool post = item->second.pending == nullptr;
+    item->second.pending = std::move(snapshot);
+    item->second.pending_version = version;
+    if (post) {
+      pool_.Post([this, key] { Refresh(key); });
+    }
+  }
+
+  // The entry of |file| comes from disk again.
+  void Close(const std::string& file) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      open_.erase(GetKey(file));
+    }
+    Invalidate(file);
+  }
+
+  // Reloads the entry of |file|, which was created, changed or deleted.
+  void Invalidate(const std::string& file) {
+    auto key = GetKey(file);
+    if (!IsIndexed(key)) {
+      return;
+    }
+    {
+      // Until reloaded, lookups load it themselves rather than get it stale.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (open_.count(key) == 0) {
+        SetEntry(key, nullptr);
+        stamps_.erase(key);
+      }
+    }
+    pool_.Post([this, key] { Load(key); });
+  }
+
+  // Changes when the targets or deps of any entry do, for the checks of the
+  // dependencies to be made again.
+  auto GetGraphGeneration() -> uint64_t {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return graph_generation_;
+  }
+
+  // Gets the entries of the files imported by |file| of the project at
+  // |root|, directly or not, starting with the build config imported by all.
+  auto FindImports(const std::string& file, const base::FilePath& root)
+      -> std::vector<std::shared_ptr<const GNIndexEntry>> {
+    std::vector<std::shared_ptr<const GNIndexEntry>> result;
+    std::set<std::string> visited;
+    std::vector<std::string> pending;
+    auto follow = [&](const std::string& key, const GNIndexEntry& entry) {
+      for (const auto& path : entry.imports) {
+        auto import = ResolveImport(key, path, root);
+        if (!import.empty() && visited.insert(import).second) {
+          pending.push_back(std::move(import));
+        }
+      }
+    };
+    auto key = GetKey(file);
+    visited.insert(key);
+    if (!root.empty()) {
+      auto dot_gn =
+          GetKey(FilePathToUTF8(root.Append(FILE_PATH_LITERAL(".gn"))));
+      if (auto entry = Find(dot_gn)) {
+        follow(dot_gn, *entry);
+      }
+    }
+    if (auto entry = Find(key)) {
+      follow(key, *entry);
+    }
+    // Breadth first, so that the closest imports come first.
+    for (size_t i = 0; i < pending.size(); i++) {
+      auto import = pending[i];
+      if (auto entry = Find(import)) {
+        follow(import, *entry);
+        result.push_back(std::move(entry));
+      }
+    }
+    return result;
+  }
+
+  // Whether identifier |name| used in |file| of the project at |root| is a
+  // template or a variable shared through imports, rather than one of the
+  // file alone, such as a local or one starting with an underscore.
+  auto IsShared(const std::string& file,
+                const base::FilePath& root,
+                const std::string& name) -> bool {
+    auto exports = [&](const GNIndexEntry& entry) {
+      return std::any_of(entry.variables.begin(), entry.variables.end(),
+                         [&](const GNDeclaration& variable) {
+                           return variable.name == name;
+                         }) ||
+             std::any_of(entry.declarations.begin(), entry.declarations.end(),
+                         [&](const GNDeclaration& declaration) {
+                           return declaration.name == name &&
+                                  declaration.function == functions::kTemplate;
+                         });
+    };
+    // Build files are not imported, so what they declare stays in them.
+    auto key = GetKey(file);
+    auto base_name = UTF8ToFilePath(key).BaseName();
+    if (base_name.value() != FILE_PATH_LITERAL("BUILD.gn")) {
+      if (auto entry = Find(key); entry != nullptr && exports(*entry)) {
+        return true;
+      }
+    }
+    auto imports = FindImports(file, root);
+    return std::any_of(imports.begin(), imports.end(),
+                       [&](const std::shared_ptr<const GNIndexEntry>& entry) {
+                         return exports(*entry);
+                       });
+  }
+
+  // Gets the entries of the files using |name|, an identifier or a label.
+  auto FindReferences(const std::string& name)
+      -> std::vector<std::shared_ptr<const GNIndexEntry>> {
+    RefreshAll();
+    std::vector<std::shared_ptr<const GNIndexEntry>> result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto item = postings_.find(name);
+    if (item == postings_.end()) {
+      return result;
+    }
+    for (const auto& key : item->second) {
+      result.push_back(entries_[key]);
+    }
+    return result;
+  }
+
+  // Finds the |limit| declarations and variables whose names best match
+  // |query|, best first. An empty query matches all.
+  auto Search(std::string_view query, size_t limit)
+      -> std::vector<GNSymbolMatch> {
+    RefreshAll();
+    auto table = GetSymbols();
+    std::string pattern(query);
+    std::transform(pattern.begin(), pattern.end(), pattern.begin(),
+                   [](char c) { return ToLower(c); });
+    // Keeps the best |limit| so far, worst on top.
+    using Candidate = std::pair<int, uint32_t>;
+    std::priority_queue<Candidate, std::vector<Candidate>,
+                        std::greater<Candidate>>
+        best;
+    auto offer = [&](int score, uint32_t index) {
+      // Ties go to the first found.
+      Candidate candidate(score, std::numeric_limits<uint32_t>::max() - index);
+      if (best.size() < limit) {
+        best.push(candidate);
+      } else if (limit != 0 && best.top() < candidate) {
+        best.pop();
+        best.push(candidate);
+      }
+    };
+    const auto& names = table->names;
+    const auto& offsets = table->offsets;
+    auto count = static_cast<uint32_t>(table->symbols.size());
+    if (pattern.empty()) {
+      for (uint32_t i = 0; i < count && i < limit; i++) {
+        offer(0, i);
+      }
+    }
+    // Jumps to the names containing the first character of |pattern|, with
+    // memchr scanning the contiguous names fast.
+    size_t position = 0;
+    uint32_t index = 0;
+    while (!pattern.empty() && position < names.size()) {
+      const auto* found = static_cast<const char*>(
+          std::memchr(names.data() + position, pattern[0],
+                      names.size() - position));
+      if (found == nullptr) {
+        break;
+      }
+      auto offset = static_cast<size_t>(found - names.data());
+      index = static_cast<uint32_t>(
+          std::upper_bound(offsets.begin() + index, offsets.end(), offset) -
+          offsets.begin() - 1);
+      auto begin = offsets[index];
+      auto end = offsets[index + 1] - 1;
+      auto score = Score(std::string_view(names).substr(begin, end - begin),
+                         offset - begin, pattern);
+      if (score.has_value()) {
+        offer(*score, index);
+      }
+      position = end + 1;
+      index++;
+    }
+    std::vector<GNSymbolMatch> result(best.size());
+    for (auto i = result.size(); i-- > 0;) {
+      const auto& symbol =
+          table->symbols[std::numeric_limits<uint32_t>::max() -
+                         best.top().second];
+      result[i] = {table->entries[symbol.entry], symbol.declaration};
+      best.pop();
+    }
+    return result;
+  }
+
+  // Finds the deps of the declarations of build file |file| in the project
+  // at |root| that are not declared, and those closing a cycle. The edges
+  // are kept in the entries, so only those of changed files are made again.
+  auto CheckDependencies(const std::string& file, const base::FilePath& root)
+      -> std::vector<GNDiagnostic> {
+    constexpr size_t kNone = std::numeric_limits<size_t>::max();
+    // Bounds the walk in huge graphs.
+    constexpr size_t kMaxTargets = 100000;
+    // Also brings the graph generation up to date with the open files.
+    RefreshAll();
+    std::vector<GNDiagnostic> result;
+    auto key = GetKey(file);
+    // Targets of .gni files are declared by those importing them.
+    auto base_name = UTF8ToFilePath(key).BaseName();
+    if (root.empty() || base_name.value() != FILE_PATH_LITERAL("BUILD.gn")) {
+      return result;
+    }
+    auto entry = Find(key);
+    if (entry == nullptr) {
+      return result;
+    }
+    std::vector<GNTarget> targets;
+    std::unordered_map<std::string, size_t> ids;
+    auto add = [&](const std::string& label,
+                   std::shared_ptr<const GNIndexEntry> declared,
+                   size_t declaration) {
+      ids.emplace(label, targets.size());
+      GNTarget target;
+      target.label = label;
+      target.entry = std::move(declared);
+      target.declaration = declaration;
+      targets.push_back(std::move(target));
+      return targets.size() - 1;
+    };
+    // Gets the target of |label|, or none when not declared.
+    auto get = [&](const std::string& label) {
+      auto item = ids.find(label);
+      if (item != ids.end()) {
+        return item->second;
+      }
+      if (targets.size() >= kMaxTargets) {
+        return kNone;
+      }
+      auto [found, declaration] = Resolve(label, root);
+      if (!declaration.has_value()) {
+        ids.emplace(label, kNone);
+        return kNone;
+      }
+      return add(label, std::move(found), *declaration);
+    };
+    // Those of |entry| come first, by declaration.
+    std::vector<size_t> sources(entry->declarations.size(), kNone);
+    for (const auto& [name, index] : entry->labels) {
+      auto label = MakeLabel(key, root, ":" + name);
+      if (!label.empty() && ids.count(label) == 0) {
+        sources[index] = add(label, entry, index);
+      }
+    }
+    auto starts = targets.size();
+    for (const auto& dependency : entry->dependencies) {
+      if (get(dependency.label) == kNone &&
+          !IsGenerated(dependency.label, root)) {
+        result.push_back(
+            {dependency.range, "Unresolved label " + dependency.label});
+      }
+    }
+
+    // Strongly connected components, by Tarjan's algorithm without
+    // recursion. Dependencies are resolved as targets are first visited.
+    size_t visits = 0;
+    size_t components = 0;
+    std::vector<size_t> stack;
+    // Targets being visited, with their next dependency.
+    std::vector<std::pair<size_t, size_t>> frames;
+    auto visit = [&](size_t id) {
+      std::vector<size_t> dependencies;
+      auto target = targets[id].entry;
+      auto declaration = targets[id].declaration;
+      for (const auto& dependency : target->dependencies) {
+        if (dependency.declaration == declaration) {
+          auto next = get(dependency.label);
+          if (next != kNone) {
+            dependencies.push_back(next);
+          }
+        }
+      }
+      auto& visited = targets[id];
+      visited.dependencies = std::move(dependencies);
+      visited.order = visited.low = visits++;
+      visited.stacked = true;
+      stack.push_back(id);
+      frames.emplace_back(id, 0);
+    };
+    for (size_t start = 0; start < starts; start++) {
+      if (targets[start].order != kNone) {
+        continue;
+      }
+      visit(start);
+      while (!frames.empty()) {
+        auto [id, next] = frames.back();
+        if (next < targets[id].dependencies.size()) {
+          frames.back().second++;
+          auto dependency = targets[id].dependencies[next];
+          if (targets[dependency].order == kNone) {
+            visit(dependency);
+          } else if (targets[dependency].stacked) {
+            targets[id].low =
+                std::min(targets[id].low, targets[dependency].order);
+          }
+          continue;
+        }
+        frames.pop_back();
+        if (targets[id].low == targets[id].order) {
+          size_t member = kNone;
+          do {
+            member = stack.back();
+            stack.pop_back();
+            targets[member].stacked = false;
+            targets[member].component = components;
+          } while (member != id);
+          components++;
+        }
+        if (!frames.empty()) {
+          auto& parent = targets[frames.back().first];
+          parent.low = std::min(parent.low, targets[id].low);
+        }
+      }
+    }
+
+    for (const auto& dependency : entry->dependencies) {
+      auto source = sources[dependency.declaration];
+      auto item = ids.find(dependency.label);
+      auto id = item != ids.end() ? item->second : kNone;
+      if (source == kNone || id == kNone ||
+          targets[source].component != targets[id].component) {
+        continue;
+      }
+      // The shortest way back to |source|, breadth first in the component.
+      std::unordered_map<size_t, size_t> previous{{id, kNone}};
+      std::deque<size_t> pending{id};
+      while (!pending.empty() && previous.count(source) == 0) {
+        auto current = pending.front();
+        pending.pop_front();
+        for (auto next : targets[current].dependencies) {
+          if (targets[next].component == targets[id].component &&
+              previous.emplace(next, current).second) {
+            pending.push_back(next);
+          }
+        }
+      }
+      if (previous.count(source) == 0) {
+        continue;
+      }
+      std::vector<size_t> path;
+      for (auto current = id == source ? kNone : source; current != kNone;
+           current = previous[current]) {
+        path.push_back(current);
+      }
+      auto message = "Dependency cycle: " + targets[source].label;
+      for (auto i = path.size(); i-- > 0;) {
+        message += " -> " + targets[path[i]].label;
+      }
+      if (id == source) {
+        message += " -> " + targets[source].label;
+      }
+      result.push_back({dependency.range, std::move(message)});
+    }
+    return result;
+  }
+
+  // Gets the entry of |file|, loading it right away if not indexed yet.
+  auto Find(const std::string& file) -> std::shared_ptr<const GNIndexEntry> {
+    auto key = GetKey(file);
+    bool pending = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto open = open_.find(key);
+      pending = open != open_.end() && open->second.pending != nullptr;
+      auto item = entries_.find(key);
+      if (!pending && item != entries_.end()) {
+        return item->second;
+      }
+    }
+    if (pending) {
+      Refresh(key);
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto item = entries_.find(key);
+      if (item != entries_.end()) {
+        return item->second;
+      }
+    }
+    return IsIndexed(key) ? Load(key) : nullptr;
+  }
+
+ private:
+  struct GNOpenFile {
+    const GNDocument* document = nullptr;
+    // Version of the document the entry is from.
+    uint64_t version = 0;
+    // Last update not in the entry yet, until refreshed.
+    std::shared_ptr<const GNSnapshot> pending;
+    uint64_t pending_version = 0;
+  };
+
+  // Declaration reached checking dependencies, as a node of the graph.
+  struct GNTarget {
+    std::string label;
+    std::shared_ptr<const GNIndexEntry> entry;
+    size_t declaration = 0;
+    // The targets of its deps that are declared, once visited.
+    std::vector<size_t> dependencies;
+    // Visit order, lowest order reachable, and component, by Tarjan's
+    // algorithm.
+    size_t order = std::numeric_limits<size_t>::max();
+    size_t low = 0;
+    size_t component = 0;
+    bool stacked = false;
+  };
+
+  struct GNSymbol {
+    uint32_t entry = 0;
+    const GNDeclaration* declaration = nullptr;
+  };
+
+  // Names of all declarations and variables of the index in lower case, each
+  // followed by a null character, as of |generation|.
+  struct GNSymbolTable {
+    uint64_t generation = 0;
+    std::vector<std::shared_ptr<const GNIndexEntry>> entries;
+    std::vector<GNSymbol> symbols;
+    std::string names;
+    // Where each name begins, and where one past the last would.
+    std::vector<size_t> offsets;
+  };
+
+  static auto ToLower(char c) -> char {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  // Score of |name| matching |pattern| in order, from |first| where the first
+  // character is. Matches at word starts and in runs score higher, and
+  // shorter names break ties.
+  static auto Score(std::string_view name,
+                    size_t first,
+                    std::string_view pattern) -> std::optional<int> {
+    constexpr int kMatch = 1;
+    constexpr int kWordStart = 8;
+    constexpr int kRun = 4;
+    constexpr int kLengthDivisor = 16;
+    auto word_start = [name](size_t index) {
+      return index == 0 || name[index - 1] == '_' || name[index - 1] == '/' ||
+             name[index - 1] == '-' || name[index - 1] == '.';
+    };
+    int score = 0;
+    size_t previous = std::string_view::npos;
+    size_t index = first;
+    for (auto c : pattern) {
+      if (previous != std::string_view::npos) {
+        index = name.find(c, previous + 1);
+        if (index == std::string_view::npos) {
+          return std::nullopt;
+        }
+      }
+      score += kMatch;
+      if (word_start(index)) {
+        score += kWordStart;
+      }
+      if (previous != std::string_view::npos && index == previous + 1) {
+        score += kRun;
+      }
+      previous = index;
+    }
+    return score - static_cast<int>(name.size()) / kLengthDivisor;
+  }
+
+  // Gets the symbol table, built again when the index changed.
+  auto GetSymbols() -> std::shared_ptr<const GNSymbolTable> {
+    auto table = std::make_shared<GNSymbolTable>();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (symbols_ != nullptr && symbols_->generation == generation_) {
+        return symbols_;
+      }
+      table->generation = generation_;
+      for (const auto& [key, entry] : entries_) {
+        table->entries.push_back(entry);
+      }
+    }
+    for (uint32_t i = 0; i < table->entries.size(); i++) {
+      const auto& entry = *table->entries[i];
+      auto add = [&](const GNDeclaration& declaration) {
+        table->symbols.push_back({i, &declaration});
+        table->offsets.push_back(table->names.size());
+        for (auto c : declaration.name) {
+          table->names.push_back(ToLower(c));
+        }
+        table->names.push_back('\0');
+      };
+      for (const auto& declaration : entry.declarations) {
+        add(declaration);
+      }
+      for (const auto& variable : entry.variables) {
+        add(variable);
+      }
+    }
+    table->offsets.push_back(table->names.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (symbols_ == nullptr || symbols_->generation < table->generation) {
+      symbols_ = table;
+    }
+    return table;
+  }
+
+  // Makes the entry of the open file |key| follow its last update, if not
+  // yet. Refreshes run one at a time, so that a lookup also waits for one in
+  // progress, and each takes in the updates made until it is done.
+  void Refresh(const std::string& key) {
+    std::lock_guard<std::mutex> refreshing(refresh_mutex_);
+    for (;;) {
+      std::shared_ptr<const GNSnapshot> snapshot;
+      const GNDocument* document = nullptr;
+      uint64_t version = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto item = open_.find(key);
+        if (item == open_.end() || item->second.pending == nullptr) {
+          return;
+        }
+        snapshot = item->second.pending;
+        document = item->second.document;
+        version = item->second.pending_version;
+      }
+      auto entry = MakeEntry(key, *snapshot);
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto item = open_.find(key);
+      if (item == open_.end() || item->second.document != document) {
+        return;
+      }
+      if (item->second.version < version) {
+        item->second.version = version;
+        SetEntry(key, std::move(entry));
+      }
+      if (item->second.pending_version == version) {
+        item->second.pending = nullptr;
+        return;
+      }
+    }
+  }
+
+  // Refreshes the entries of all open files, for lookups across files.
+  void RefreshAll() {
+    std::vector<std::string> keys;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& [key, open] : open_) {
+        if (open.pending != nullptr) {
+          keys.push_back(key);
+        }
+      }
+    }
+    for (const auto& key : keys) {
+      Refresh(key);
+    }
+  }
+
+  // Replaces the entry of |key|, or removes it if null, with its postings.
+  // Called with |mutex_| held.
+  void SetEntry(const std::string& key,
+                std::shared_ptr<const GNIndexEntry> entry) {
+    generation_++;
+    auto item = entries_.find(key);
+    const auto* previous =
+        item != entries_.end() ? item->second.get() : nullptr;
+    if (!SameTargets(previous, entry.get())) {
+      graph_generation_++;
+    }
+    if (item != entries_.end()) {
+      for (const auto& [name, ranges] : item->second->references) {
+        auto posting = postings_.find(name);
+        posting->second.erase(key);
+        if (posting->second.empty()) {
+          postings_.erase(posting);
+        }
+      }
+    }
+    if (entry == nullptr) {
+      entries_.erase(key);
+      return;
+    }
+    for (const auto& [name, ranges] : entry->references) {
+      postings_[name].insert(key);
+    }
+    entries_[key] = std::move(entry);
+  }
+
+  // Whether |a| and |b| declare the same targets with the same deps, as far
+  // as the dependency graph goes, whatever their ranges.
+  static auto SameTargets(const GNIndexEntry* a, const GNIndexEntry* b)
+      -> bool {
+    if (a == nullptr || b == nullptr) {
+      return a == b;
+    }
+    return std::equal(a->declarations.begin(), a->declarations.end(),
+                      b->declarations.begin(), b->declarations.end(),
+                      [](const GNDeclaration& x, const GNDeclaration& y) {
+                        return x.function == y.function && x.name == y.name;
+                      }) &&
+           std::equal(a->dependencies.begin(), a->dependencies.end(),
+                      b->dependencies.begin(), b->dependencies.end(),
+                      [](const GNDependency& x, const GNDependency& y) {
+                        return x.declaration == y.declaration &&
+                               x.label == y.label;
+                      });
+  }
+
+  // Bounds the crawl in cycles of directory links.
+  static constexpr int kMaxDepth = 64;
+
+  static auto GetKey(const std::string& file) -> std::string {
+    return FilePathToUTF8(UTF8ToFilePath(file).NormalizePathSeparatorsTo('/'));
+  }
+
+  // BUILD.gn and .gni files, and the .gn file and build config of projects.
+  static auto IsIndexed(std::string_view key) -> bool {
+    constexpr std::string_view kFile = ".gn";
+    constexpr std::string_view kImport = ".gni";
+    auto ends_with = [key](std::string_view suffix) {
+      return key.size() >= suffix.size() &&
+             key.substr(key.size() - suffix.size()) == suffix;
+    };
+    return ends_with(kFile) || ends_with(kImport);
+  }
+
+  // Key of the file imported as |path| by the file of |key|, empty when
+  // relative to an unknown root.
+  static auto ResolveImport(const std::string& key,
+                            std::string_view path,
+                            const base::FilePath& root) -> std::string {
+    std::string result;
+    if (path.substr(0, 2) == "//") {
+      if (root.empty()) {
+        return {};
+      }
+      result = FilePathToUTF8(root.Append(UTF8ToFilePath(path.substr(2))));
+    } else if (path.substr(0, 1) == "/") {
+      result = path;
+    } else {
+      result = FilePathToUTF8(
+          UTF8ToFilePath(key).DirName().Append(UTF8ToFilePath(path)));
+    }
+    result = GetKey(result);
+    NormalizePath(&result);
+    return result;
+  }
+
+  // Gets the entry of the build file of source-absolute |label| in the
+  // project at |root|, and its declaration of the target if any.
+  auto Resolve(const std::string& label, const base::FilePath& root)
+      -> std::pair<std::shared_ptr<const GNIndexEntry>, std::optional<size_t>> {
+    auto colon = label.find(':');
+    auto directory = label.substr(2, colon - 2);
+    auto path =
+        directory.empty() ? root : root.Append(UTF8ToFilePath(directory));
+    auto entry =
+        Find(FilePathToUTF8(path.Append(FILE_PATH_LITERAL("BUILD.gn"))));
+    if (entry == nullptr) {
+      return {};
+    }
+    auto item = entry->labels.find(label.substr(colon + 1));
+    if (item == entry->labels.end()) {
+      return {std::move(entry), std::nullopt};
+    }
+    return {std::move(entry), item->second};
+  }
+
+  // Whether undeclared |label| may be made by a template from one declared
+  // in the same file with it, as foo_unittests from foo, named only at gn
+  // time. Builtin functions make no such targets.
+  auto IsGenerated(const std::string& label, const base::FilePath& root)
+      -> bool {
+    auto [entry, declaration] = Resolve(label, root);
+    if (entry == nullptr) {
+      return false;
+    }
+    auto name = std::string_view(label).substr(label.find(':') + 1);
+    const auto& builtins = functions::GetFunctions();
+    return std::any_of(
+        entry->declarations.begin(), entry->declarations.end(),
+        [&](const GNDeclaration& declared) {
+          return builtins.count(declared.function) == 0 &&
+                 name.size() > declared.name.size() &&
+                 name.compare(0, declared.name.size(), declared.name) == 0 &&
+                 name[declared.name.size()] == '_';
+        });
+  }
+
+  // Label of string |value| in the file of |key|, made source-absolute with
+  // a target name, or empty when it does not look like one.
+  static auto MakeLabel(const std::string& key,
+                        const base::FilePath& root,
+                        std::string_view value) -> std::string {
+    value = value.substr(0, value.find('('));
+    auto colon = value.find(':');
+    auto directory = value.substr(0, colon);
+    auto name = colon != std::string_view::npos ? value.substr(colon + 1)
+                                                : std::string_view();
+    std::string result;
+    if (directory.empty() && !name.empty() && !root.empty()) {
+      // Relative to the directory of |key| under |root|.
+      auto prefix = GetKey(FilePathToUTF8(root));
+      auto parent = key.substr(0, key.rfind('/'));
+      if (parent == prefix) {
+        result = "//";
+      } else if (parent.compare(0, prefix.size() + 1, prefix + '/') == 0) {
+        result = "//" + parent.substr(prefix.size() + 1);
+      } else {
+        return {};
+      }
+    } else if (directory.substr(0, 2) == "//") {
+      while (directory.size() > 2 && directory.back() == '/') {
+        directory.remove_suffix(1);
+      }
+      result = directory;
+    } else {
+      return {};
+    }
+    if (name.empty()) {
+      // Named after the directory, unless a path to a file.
+      name = directory.substr(directory.rfind('/') + 1);
+      if (name.empty() || name.find('.') != std::string_view::npos) {
+        return {};
+      }
+    }
+    return result.append(":").append(name);
+  }
+
+  auto MakeEntry(const std::string& key, const GNSnapshot& snapshot)
+      -> std::shared_ptr<const GNIndexEntry> {
+    auto entry = std::make_shared<GNIndexEntry>();
+    entry->file = key;
+    auto root = roots_->Find(UTF8ToFilePath(key).DirName());
+    for (const auto& declare : snapshot.ParseScope().declares) {
+      const auto* node = declare.node;
+      const auto& arguments = node->args()->contents();
+      auto argument = [&arguments](size_t index) -> std::string_view {
+        if (index >= arguments.size()) {
+          return {};
+        }
+        const auto* literal = arguments[index]->AsLiteral();
+        if (literal == nullptr ||
+            literal->value().type() != Token::Type::STRING) {
+          return {};
+        }
+        // Without the quotes.
+        auto value = literal->value().value();
+        return value.substr(1, value.size() - 2);
+      };
+      std::string_view function = node->function().value();
+      std::string_view name = argument(0);
+      if (function == functions::kTarget) {
+        function = argument(0);
+        name = argument(1);
+      }
+      if (name.empty()) {
+        continue;
+      }
+      auto range = declare.GetRange();
+      entry->labels.emplace(name, entry->declarations.size());
+      AddDependencies(*entry, key, root, entry->declarations.size(),
+                      node->block(), declare.lines);
+      entry->declarations.push_back(
+          {std::string(function), std::string(name),
+           range.begin().line_number(), range.begin().column_number(),
+           range.end().line_number(), range.end().column_number()});
+    }
+    for (const auto& statement : snapshot.GetStatements()) {
+      AddImported(*entry, statement.node, statement.lines);
+      AddReferences(*entry, key, root, statement.node, statement.lines);
+    }
+    entry->SortPositions();
+    return entry;
+  }
+
+  // Adds the labels in the deps and public_deps set in |node| to |entry|, as
+  // those of its declaration at |index|, also under conditions. Locations
+  // are moved down |lines| lines, as the statement of |node| moved.
+  static void AddDependencies(GNIndexEntry& entry,
+                              const std::string& key,
+                              const base::FilePath& root,
+                              size_t index,
+                              const ParseNode* node,
+                              int lines) {
+    if (node == nullptr) {
+      return;
+    }
+    if (const auto* block = node->AsBlock()) {
+      for (const auto& statement : block->statements()) {
+        AddDependencies(entry, key, root, index, statement.get(), lines);
+      }
+    } else if (const auto* condition = node->AsCondition()) {
+      AddDependencies(entry, key, root, index, condition->if_true(), lines);
+      AddDependencies(entry, key, root, index, condition->if_false(), lines);
+    } else if (const auto* binary_op = node->AsBinaryOp()) {
+      const auto* identifier = binary_op->left()->AsIdentifier();
+      const auto* list = binary_op->right()->AsList();
+      if (identifier == nullptr || list == nullptr ||
+          (binary_op->op().type() != Token::EQUAL &&
+           binary_op->op().type() != Token::PLUS_EQUALS)) {
+        return;
+      }
+      std::string_view name = identifier->value().value();
+      if (name != variables::kDeps && name != variables::kPublicDeps) {
+        return;
+      }
+      for (const auto& item : list->contents()) {
+        const auto* literal = item->AsLiteral();
+        if (literal == nullptr ||
+            literal->value().type() != Token::Type::STRING) {
+          continue;
+        }
+        const auto& token = literal->value();
+        auto value = token.value().substr(1, token.value().size() - 2);
+        // Expansions are only known to gn.
+        if (value.find('$') != std::string_view::npos) {
+          continue;
+        }
+        auto label = MakeLabel(key, root, value);
+        if (!label.empty()) {
+          auto range = GNShift(token.range(), lines);
+          entry.dependencies.push_back(
+              {index, std::move(label),
+               {range.begin().line_number(), range.begin().column_number(),
+                range.end().line_number(), range.end().column_number()}});
+        }
+      }
+    }
+  }
+
+  // Adds the identifiers and labels used in |node| to |entry|, moved down
+  // |lines| lines.
+  static void AddReferences(GNIndexEntry& entry,
+                            const std::string& key,
+                            const base::FilePath& root,
+                            const ParseNode* node,
+                            int lines) {
+    if (node == nullptr) {
+      return;
+    }
+    auto add = [&](const std::string& name, const LocationRange& range) {
+      entry.references[name].push_back(
+          {range.begin().line_number() + lines, range.begin().column_number(),
+           range.end().line_number() + lines, range.end().column_number()});
+    };
+    auto add_token = [&](const Token& token) {
+      add(std::string(token.value()), token.range());
+    };
+    auto add_string = [&](const ParseNode* node, bool label) {
+      const auto* literal = node != nullptr ? node->AsLiteral() : nullptr;
+      if (literal == nullptr ||
+          literal->value().type() != Token::Type::STRING) {
+        return;
+      }
+      const auto& token = literal->value();
+      auto value = token.value().substr(1, token.value().size() - 2);
+      if (label) {
+        // A declaration, named relative to its file.
+        auto name = MakeLabel(key, root, std::string(":").append(value));
+        if (!name.empty()) {
+          add(name, token.range());
+        }
+        return;
+      }
+      // Without the quotes, to be renamed.
+      auto begin = token.range().begin();
+      add(std::string(value),
+          LocationRange(Location(begin.file(), begin.line_number(),
+                                 begin.column_number() + 1),
+                        Location(begin.file(), begin.line_number(),
+                                 begin.column_number() + 1 +
+                                     static_cast<int>(value.size()))));
+    };
+    if (const auto* accessor = node->AsAccessor()) {
+      add_token(accessor->base());
+      if (const auto* member = accessor->member()) {
+        add_token(member->value());
+      }
+      AddReferences(entry, key, root, accessor->subscript(), lines);
+    } else if (const auto* binary_op = node->AsBinaryOp()) {
+      AddReferences(entry, key, root, binary_op->left(), lines);
+      AddReferences(entry, key, root, binary_op->right(), lines);
+    } else if (const auto* block = node->AsBlock()) {
+      for (const auto& statement : block->statements()) {
+        AddReferences(entry, key, root, statement.get(), lines);
+      }
+    } else if (const auto* condition = node->AsCondition()) {
+      AddReferences(entry, key, root, condition->condition(), lines);
+      AddReferences(entry, key, root, condition->if_true(), lines);
+      AddReferences(entry, key, root, condition->if_false(), lines);
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      const auto& function = function_call->function();
+      const auto& arguments = function_call->args()->contents();
+      add_token(function);
+      if (!arguments.empty() && function_call->block() != nullptr) {
+        // Templates are used by name, and targets by label.
+        add_string(arguments[0].get(),
+                   function.value() != functions::kTemplate);
+      }
+      AddReferences(entry, key, root, function_call->args(), lines);
+      AddReferences(entry, key, root, function_call->block(), lines);
+    } else if (const auto* identifier = node->AsIdentifier()) {
+      add_token(identifier->value());
+    } else if (const auto* list = node->AsList()) {
+      for (const auto& item : list->contents()) {
+        AddReferences(entry, key, root, item.get(), lines);
+      }
+    } else if (const auto* literal = node->AsLiteral()) {
+      const auto& token = literal->value();
+      if (token.type() == Token::Type::STRING) {
+        auto value = token.value();
+        auto name = MakeLabel(key, root, value.substr(1, value.size() - 2));
+        if (!name.empty()) {
+          add(name, token.range());
+        }
+      }
+    } else if (const auto* unary_op = node->AsUnaryOp()) {
+      AddReferences(entry, key, root, unary_op->operand(), lines);
+    }
+  }
+
+  // Adds the imports and variables of top-level |node| to |entry|, also
+  // under conditions and in declare_args(), moved down |lines| lines.
+  static void AddImported(GNIndexEntry& entry,
+                          const ParseNode* node,
+                          int lines) {
+    constexpr std::string_view kBuildConfig = "buildconfig";
+    if (node == nullptr) {
+      return;
+    }
+    auto string = [](const ParseNode* node) -> std::string_view {
+      const auto* literal = node != nullptr ? node->AsLiteral() : nullptr;
+      if (literal == nullptr ||
+          literal->value().type() != Token::Type::STRING) {
+        return {};
+      }
+      auto value = literal->value().value();
+      return value.substr(1, value.size() - 2);
+    };
+    if (const auto* binary_op = node->AsBinaryOp()) {
+      const auto* identifier = binary_op->left()->AsIdentifier();
+      if (identifier == nullptr || binary_op->op().type() != Token::EQUAL) {
+        return;
+      }
+      std::string_view name = identifier->value().value();
+      if (name == kBuildConfig) {
+        auto path = string(binary_op->right());
+        if (!path.empty()) {
+          entry.imports.emplace_back(path);
+        }
+      } else if (name.front() != '_' &&
+                 std::none_of(entry.variables.begin(), entry.variables.end(),
+                              [name](const GNDeclaration& variable) {
+                                return variable.name == name;
+                              })) {
+        // Names starting with an underscore are not imported.
+        auto range = GNShift(identifier->GetRange(), lines);
+        entry.variables.push_back(
+            {"", std::string(name), range.begin().line_number(),
+             range.begin().column_number(), range.end().line_number(),
+             range.end().column_number()});
+      }
+    } else if (const auto* block = node->AsBlock()) {
+      for (const auto& statement : block->statements()) {
+        AddImported(entry, statement.get(), lines);
+      }
+    } else if (const auto* condition = node->AsCondition()) {
+      AddImported(entry, condition->if_true(), lines);
+      AddImported(entry, condition->if_false(), lines);
+    } else if (const auto* function_call = node->AsFunctionCall()) {
+      std::string_view function = function_call->function().value();
+      const auto& arguments = function_call->args()->contents();
+      if (function == functions::kImport && !arguments.empty()) {
+        auto path = string(arguments[0].get());
+        if (!path.empty()) {
+          entry.imports.emplace_back(path);
+        }
+      } else if (function == functions::kDeclareArgs) {
+        AddImported(entry, function_call->block(), lines);
+      }
+    }
+  }
+
+  void CrawlDirectory(const base::FilePath& directory, int depth) {
+    base::FileEnumerator enumerator(
+        directory, false,
+        base::FileEnumerator::FILES | base::FileEnumerator::DIRECTORIES);
+    for (auto path = enumerator.Next(); !path.empty();
+         path = enumerator.Next()) {
+      if (enumerator.GetInfo().IsDirectory()) {
+        // Skips .git and the like.
+        auto name = FilePathToUTF8(path.BaseName());
+        if (name.front() != '.' && depth < kMaxDepth) {
+          pool_.Post([this, path, depth] { CrawlDirectory(path, depth + 1); });
+        }
+        continue;
+      }
+      auto key = GetKey(FilePathToUTF8(path));
+      if (!IsIndexed(key)) {
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (entries_.count(key) != 0) {
+          continue;
+        }
+      }
+      Load(key);
+    }
+  }
+
+  auto Load(const std::string& key) -> std::shared_ptr<const GNIndexEntry> {
+    std::shared_ptr<const GNIndexEntry> entry;
+    auto path = UTF8ToFilePath(key);
+    auto stamp = GNFileStamp::Get(path);
+    std::string contents;
+    if (stamp.has_value()) {
+      // Loaded since, as by a lookup racing the reload of a change.
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto item = entries_.find(key);
+      auto loaded = stamps_.find(key);
+      if (item != entries_.end() && loaded != stamps_.end() &&
+          loaded->second.size == stamp->size &&
+          loaded->second.modified == stamp->modified) {
+        return item->second;
+      }
+    }
+    if (stamp.has_value()) {
+      entry = cache_.Find(key, *stamp);
+      if (entry == nullptr && base::ReadFileToString(path, &contents)) {
+        // Also found when touched without changes, as by a checkout.
+        stamp->hash = GNFileStamp::Hash(contents);
+        entry = cache_.Find(key, *stamp);
+      }
+      if (entry == nullptr && stamp->hash != 0) {
+        // The root only matters to analysis.
+        GNDocument document(key, {});
+        document.UpdateContent(std::move(contents));
+        entry = MakeEntry(key, *document.GetSnapshot());
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (open_.count(key) != 0) {
+      auto item = entries_.find(key);
+      return item != entries_.end() ? item->second : nullptr;
+    }
+    SetEntry(key, entry);
+    if (entry != nullptr) {
+      stamps_[key] = *stamp;
+    } else {
+      stamps_.erase(key);
+    }
+    return entry;
+  }
+
+  std::shared_ptr<GNRoots> roots_;
+  std::mutex mutex_;
+  std::set<std::string> crawled_;
+  std::unordered_map<std::string, GNOpenFile> open_;
+  // Held while refreshing the entry of an open file.
+  std::mutex refresh_mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const GNIndexEntry>>
+      entries_;
+  // Keys of the entries using each name.
+  std::unordered_map<std::string, std::set<std::string>> postings_;
+  // Changes of |entries_|, and the symbol table of the last one searched.
+  uint64_t generation_ = 0;
+  // Changes of the targets and deps of |entries_|.
+  uint64_t graph_generation_ = 0;
+  std::shared_ptr<const GNSymbolTable> symbols_;
+  // Files of the entries loaded from disk, and the generation last saved.
+  std::unordered_map<std::string, GNFileStamp> stamps_;
+  uint64_t saved_ = 0;
+  GNIndexCache cache_;
+  // Last, so that no task outlives the members above.
+  GNThreadPool pool_;
+};
+
+#endif  // GNLS_ADDON_CORE_H_
@@ -177,11 +177,21 @@ function run(target?: string) {
       exec(npx('eslint'), '.')
       exec(npx('prettier'), '--check', '.')
       exec('clang-tidy', ...list('addon', /\.cc$/))
-      exec('clang-format', '--dry-run', '-Werror', ...list('addon', /\.cc$/))
+      exec('clang-format', '--dry-run', '-Werror', ...list('addon', /\.(cc|h)$/))
+      break
+    case 'bench':
+      // Run after building, with the addon.
+      chdir('addon')
+      exec('build/Release/bench')
+      break
+    case 'replay':
+      // Run after building, with the addon. Options are passed on.
+      chdir('.')
+      exec(npx('jiti'), path.join('script', 'replay.ts'), ...process.argv.slice(3))
       break
     case 'format':
       exec(npx('prettier'), '--write', '.')
-      exec('clang-format', '-i', ...list('addon', /\.cc$/))
+      exec('clang-format', '-i', ...list('addon', /\.(cc|h)$/))
       break
     case 'package':
       chdir('.')
@@ -0,0 +1,256 @@
+// Replays an editing session through the language server and the addon in
+// this process, and reports the latency of each kind of message and the peak
+// memory. The session is synthesized over a generated workspace, or read from
+// a trace of JSON-RPC messages, one per line, with URIs relative to the
+// workspace.
+//
+//   jiti script/replay.ts [--dirs=200] [--targets=10] [--steps=2000] [--seed=1]
+//                         [--workspace=dir] [--trace=file] [--save-trace=file]
+
+import * as fs from 'fs'
+import * as net from 'net'
+import * as os from 'os'
+import * as path from 'path'
+import {parseArgs} from 'util'
+import * as ls from 'vscode-languageserver/node'
+import * as lstd from 'vscode-languageserver-textdocument'
+import {URI} from 'vscode-uri'
+
+interface Message {
+  id?: number
+  method: string
+  params: unknown
+}
+
+// Time given to the server to publish diagnostics after a change.
+const diagnosticsTimeout = 10000
+// Stands for the workspace in the URIs of saved traces, which are replayed
+// over the workspace given then.
+const workspaceToken = '%WORKSPACE%'
+
+// Deterministic, so that a seed always makes the same workspace and session.
+function random(seed: number): () => number {
+  return () => {
+    seed = (seed + 0x6d2b79f5) | 0
+    let t = Math.imul(seed ^ (seed >>> 15), 1 | seed)
+    t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296
+  }
+}
+
+// Writes a project of |dirs| directories of |targets| targets each, depending
+// on targets of other directories, and returns its build files.
+function generate(workspace: string, dirs: number, targets: number, next: () => number): string[] {
+  const write = (file: string, content: string) => {
+    fs.mkdirSync(path.dirname(file), {recursive: true})
+    fs.writeFileSync(file, content)
+  }
+  write(path.join(workspace, '.gn'), 'buildconfig = "//build/BUILDCONFIG.gn"\n')
+  write(path.join(workspace, 'build', 'BUILDCONFIG.gn'), 'is_linux = true\nis_debug = false\n')
+  const config = [
+    'declare_args() {',
+    '  use_feature = false',
+    '}',
+    '',
+    'template("component") {',
+    '  source_set(target_name) {',
+    '    forward_variables_from(invoker, "*")',
+    '  }',
+    '}',
+  ]
+  write(path.join(workspace, 'build', 'config.gni'), config.join('\n') + '\n')
+  const files = [] as string[]
+  for (let dir = 0; dir < dirs; dir++) {
+    let content = 'import("//build/config.gni")\n\n'
+    for (let target = 0; target < targets; target++) {
+      const name = `t${target.toString()}`
+      content += `# Target ${target.toString()} of dir${dir.toString()}.\n`
+      content += `${target % 2 ? 'component' : 'source_set'}("${name}") {\n  sources = [\n`
+      for (let source = 0; source < 8; source++) {
+        content += `    "${name}_${source.toString()}.cc",\n`
+      }
+      content += '  ]\n  deps = [\n'
+      for (let dep = 0; dep < 3; dep++) {
+        const other = Math.floor(next() * dirs).toString()
+        content += `    "//dir${other}:t${Math.floor(next() * targets).toString()}",\n`
+      }
+      content += '  ]\n  if (is_linux) {\n    defines = [ "LINUX" ]\n  }\n}\n\n'
+    }
+    const file = path.join(workspace, `dir${dir.toString()}`, 'BUILD.gn')
+    write(file, content)
+    files.push(file)
+  }
+  return files
+}
+
+// A session typing sources into the targets of some of |files|, asking for
+// completions as it goes, and now and then for hovers, definitions, symbols
+// and formatting.
+function synthesize(files: string[], steps: number, next: () => number): Message[] {
+  const result = [] as Message[]
+  let id = 0
+  const request = (method: string, params: unknown) => result.push({id: id++, method, params})
+  const notify = (method: string, params: unknown) => result.push({method, params})
+  let document: lstd.TextDocument | undefined
+  let typing = ''
+  let offset = 0
+  for (let step = 0; step < steps; step++) {
+    if (!document || step % 200 == 0) {
+      if (document) notify('textDocument/didClose', {textDocument: {uri: document.uri}})
+      const file = files[Math.floor(next() * files.length)] ?? ''
+      const uri = URI.file(file).toString()
+      document = lstd.TextDocument.create(uri, 'gn', 1, fs.readFileSync(file, 'utf-8'))
+      notify('textDocument/didOpen', {textDocument: {uri, languageId: 'gn', version: 1, text: document.getText()}})
+    }
+    const uri = document.uri
+    if (!typing) {
+      // A new source in a random target, typed one character at a time.
+      const text = document.getText()
+      const sources = '  sources = [\n'
+      typing = `    "typed_${step.toString()}.cc",\n`
+      offset = text.indexOf(sources, Math.floor(next() * text.length))
+      offset = (offset < 0 ? text.indexOf(sources) : offset) + sources.length
+    }
+    const position = document.positionAt(offset)
+    const change = {range: {start: position, end: position}, text: typing[0] ?? ''}
+    document = lstd.TextDocument.update(document, [change], document.version + 1)
+    notify('textDocument/didChange', {textDocument: {uri, version: document.version}, contentChanges: [change]})
+    offset++
+    typing = typing.slice(1)
+
+    const text = document.getText()
+    // Position of |needle| from a random place, or from the start.
+    const find = (needle: string, shift: number) => {
+      let index = text.indexOf(needle, Math.floor(next() * text.length))
+      index = index < 0 ? text.indexOf(needle) : index
+      return index < 0 ? undefined : {textDocument: {uri}, position: document?.positionAt(index + shift)}
+    }
+    if (step % 4 == 0) request('textDocument/completion', {textDocument: {uri}, position: document.positionAt(offset)})
+    // On the variable name, and in the label.
+    if (step % 10 == 0) request('textDocument/hover', find('  sources', 3))
+    if (step % 10 == 5) request('textDocument/definition', find('"//dir', 3))
+    if (step % 50 == 0) request('textDocument/documentSymbol', {textDocument: {uri}})
+    if (step % 100 == 0) {
+      request('textDocument/formatting', {textDocument: {uri}, options: {tabSize: 2, insertSpaces: true}})
+    }
+  }
+  if (document) notify('textDocument/didClose', {textDocument: {uri: document.uri}})
+  return result
+}
+
+// Nearest rank of |p| percent in sorted |values|.
+function percentile(values: number[], p: number): number {
+  return values[Math.max(0, Math.ceil((p / 100) * values.length) - 1)] ?? 0
+}
+
+function report(latencies: Map<string, number[]>, peak: number) {
+  const columns = ['message', 'count', 'p50 ms', 'p95 ms', 'p99 ms', 'max ms']
+  console.log(columns.map((column, i) => (i ? column.padStart(10) : column.padEnd(32))).join(''))
+  for (const [method, values] of [...latencies].sort()) {
+    values.sort((a, b) => a - b)
+    const numbers = [50, 95, 99, 100].map((p) => percentile(values, p).toFixed(2).padStart(10))
+    console.log(`${method.padEnd(32)}${values.length.toString().padStart(10)}${numbers.join('')}`)
+  }
+  console.log(`peak RSS ${(peak / 1024 / 1024).toFixed(1)} MB`)
+}
+
+async function main() {
+  const {values: options} = parseArgs({
+    options: {
+      'dirs': {type: 'string', default: '200'},
+      'targets': {type: 'string', default: '10'},
+      'steps': {type: 'string', default: '2000'},
+      'seed': {type: 'string', default: '1'},
+      'workspace': {type: 'string'},
+      'trace': {type: 'string'},
+      'save-trace': {type: 'string'},
+    },
+  })
+  const next = random(Number(options.seed))
+  if (options.trace && !options.workspace) {
+    console.error('--trace needs --workspace, with the files of the session')
+    process.exit(1)
+  }
+  const workspace = options.workspace ?? fs.mkdtempSync(path.join(os.tmpdir(), 'gnls-replay-'))
+  const uri = URI.file(workspace).toString()
+  let messages: Message[]
+  if (options.trace) {
+    const lines = fs.readFileSync(options.trace, 'utf-8').split('\n')
+    messages = lines
+      .filter((line) => line.trim())
+      .map((line) => JSON.parse(line.split(`${workspaceToken}/`).join(`${uri}/`)) as Message)
+  } else {
+    const files = generate(workspace, Number(options.dirs), Number(options.targets), next)
+    messages = synthesize(files, Number(options.steps), next)
+    if (options['save-trace']) {
+      const lines = messages.map((message) => JSON.stringify(message).split(`${uri}/`).join(`${workspaceToken}/`))
+      fs.writeFileSync(options['save-trace'], lines.map((line) => line + '\n').join(''))
+    }
+  }
+
+  // The server connects to this process over a socket, as an editor may have
+  // it do, and runs in it.
+  const listener = net.createServer()
+  await new Promise<void>((resolve) => listener.listen(0, '127.0.0.1', resolve))
+  const accepted = new Promise<net.Socket>((resolve) => listener.once('connection', resolve))
+  process.argv.push(`--socket=${(listener.address() as net.AddressInfo).port.toString()}`)
+  await import('../src/server')
+  const socket = await accepted
+  const connection = ls.createProtocolConnection(new ls.StreamMessageReader(socket), new ls.StreamMessageWriter(socket))
+  const waiting = new Map<string, () => void>()
+  connection.onNotification(ls.PublishDiagnosticsNotification.type, (params) => {
+    waiting.get(params.uri)?.()
+    waiting.delete(params.uri)
+  })
+  connection.listen()
+
+  await connection.sendRequest(ls.InitializeRequest.type, {
+    processId: process.pid,
+    rootUri: uri,
+    workspaceFolders: [{uri, name: path.basename(workspace)}],
+    capabilities: {},
+  })
+  await connection.sendNotification(ls.InitializedNotification.type, {})
+
+  // Changes are done once their diagnostics are published.
+  const latencies = new Map<string, number[]>()
+  let peak = process.memoryUsage().rss
+  for (const message of messages) {
+    const begin = performance.now()
+    if (message.id !== undefined) {
+      await connection.sendRequest(message.method, message.params)
+    } else if (message.method == 'textDocument/didOpen' || message.method == 'textDocument/didChange') {
+      const document = (message.params as {textDocument: {uri: string}}).textDocument.uri
+      let timer: NodeJS.Timeout | undefined
+      const published = new Promise<void>((resolve) => {
+        waiting.set(document, resolve)
+        timer = setTimeout(resolve, diagnosticsTimeout)
+      })
+      await connection.sendNotification(message.method, message.params)
+      await published
+      clearTimeout(timer)
+    } else {
+      await connection.sendNotification(message.method, message.params)
+    }
+    const values = latencies.get(message.method) ?? []
+    values.push(performance.now() - begin)
+    latencies.set(message.method, values)
+    peak = Math.max(peak, process.memoryUsage().rss)
+  }
+  // Also counts the peaks between samples, where the platform tells.
+  peak = Math.max(peak, process.resourceUsage().maxRSS * 1024)
+
+  console.log(`${messages.length.toString()} messages over ${workspace}`)
+  report(latencies, peak)
+  // Kept along with a trace, for it to be replayed.
+  if (options['save-trace']) {
+    console.log(`workspace kept at ${workspace}`)
+  } else if (!options.workspace) {
+    fs.rmSync(workspace, {recursive: true})
+  }
+  await connection.sendRequest(ls.ShutdownRequest.type)
+  // Ends the process, with the server.
+  await connection.sendNotification(ls.ExitNotification.type)
+}
+
+void main()
@@ -1,5 +1,7 @@
 import * as gn from './gn'
 import * as fs from 'fs/promises'
+import * as os from 'os'
+import * as path from 'path'
 import * as testData from './gn.test.data'
 
 const root = './addon/gn/examples/simple_build'
@@ -55,6 +57,9 @@ it('simple_build/BUILD.gn', async () => {
   expect(sharedLibrary?.link).toEqual('https://gn.googlesource.com/gn/+/main/docs/reference.md#func_shared_library')
   expect(sharedLibrary?.basic).toEqual('shared_library: Declare a shared library target.')
   expect(sharedLibrary?.full).toContain('shared_library: Declare a shared library target.')
+  expect(gn.catalog().functions['shared_library']).toEqual({basic: sharedLibrary?.basic, link: sharedLibrary?.link})
+  expect(gn.catalog().variables['sources']?.link).toEqual(gn.help('variable', 'sources')?.link)
+  expect(gn.catalog()).toBe(gn.catalog())
 
   testGNAnalyze(rootPath, testData.rootGNAnalyzeResult)
 
@@ -92,3 +97,420 @@ it('simple_build/build/BUILD.gn', async () => {
   })
   gn.close(rootPath)
 })
+
+it('simple_build/BUILD.gn incremental update', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  const rootContent = await fs.readFile(rootPath, 'utf-8')
+  gn.update(rootPath, rootContent)
+
+  const expectUpdated = (content: string) => {
+    const strip = (scope: gn.Scope | null) =>
+      JSON.parse(JSON.stringify(scope, (key, value: unknown) => (key == 'file' ? undefined : value))) as unknown
+    expect(strip(gn.parse(rootPath))).toEqual(strip(gn.parse(`${root}/expected.gn`, content)))
+  }
+
+  gn.update(rootPath, [
+    {begin: {line: 1, column: 1}, end: {line: 1, column: 1}, text: 'foo = "é😀"\n'},
+    {begin: {line: 1, column: 9}, end: {line: 1, column: 11}, text: 'bar'},
+  ])
+  expectUpdated('foo = "ébar"\n' + rootContent)
+  expect(gn.parse(rootPath)?.symbols[0]?.name).toEqual('foo')
+
+  // Statements after a newline are kept, at their new lines.
+  gn.update(rootPath, [{begin: {line: 2, column: 1}, end: {line: 2, column: 1}, text: '\n'}])
+  expectUpdated('foo = "ébar"\n\n' + rootContent)
+
+  gn.update(rootPath, [{begin: {line: 1, column: 7}, end: {line: 1, column: 7}, text: '['}])
+  expect(gn.validate(rootPath)).toBeTruthy()
+
+  gn.update(rootPath, [{begin: {line: 1, column: 1}, end: {line: 3, column: 1}, text: ''}])
+  expect(gn.validate(rootPath)).toBeNull()
+  expectUpdated(rootContent)
+
+  gn.close(rootPath)
+})
+
+it('simple_build/BUILD.gn async', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  const rootContent = await fs.readFile(rootPath, 'utf-8')
+
+  const updated = gn.updateAsync(rootPath, rootContent)
+  const context = gn.analyzeAsync(rootPath, 10, 10)
+  expect(await updated).toBeNull()
+  expect(await context).toEqual(gn.analyze(rootPath, 10, 10))
+  expect(await gn.parseAsync(rootPath)).toBe(gn.parse(rootPath))
+  expect(await gn.formatAsync(rootPath)).toEqual(gn.format(rootPath))
+
+  const scope = gn.parse(rootPath)
+  const compact = gn.parse(rootPath, undefined, true)
+  expect(compact?.symbols.kinds.length).toEqual(scope?.symbols.length)
+  expect(compact && gn.getString(compact, compact.symbols.names[0] ?? 0)).toEqual(scope?.symbols[0]?.name)
+  expect(compact && gn.getCompactRange(compact.symbols.ranges, 0, rootPath)).toEqual(scope?.symbols[0]?.range)
+  const range = gn.analyze(rootPath, 10, 10, undefined, true)?.token?.range
+  expect(range && gn.getCompactRange(range, 0, rootPath)).toEqual(gn.analyze(rootPath, 10, 10)?.token?.range)
+
+  gn.close(rootPath)
+})
+
+it('simple_build stats', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  const rootContent = await fs.readFile(rootPath, 'utf-8')
+  gn.resetStats()
+  gn.update(rootPath, rootContent)
+  gn.analyze(rootPath, 10, 10)
+
+  const stats = gn.stats()
+  expect(stats.phases.tokenize.count).toBeGreaterThan(0)
+  expect(stats.phases.parse.count).toBeGreaterThan(0)
+  expect(stats.phases.analyze.count).toEqual(1)
+  expect(stats.phases.analyze.p99).toBeGreaterThan(0)
+  expect(stats.documents.find((it) => it.file == rootPath)?.bytes).toEqual(Buffer.byteLength(rootContent))
+  gn.resetStats()
+  expect(gn.stats().phases.analyze.count).toEqual(0)
+
+  gn.close(rootPath)
+})
+
+it('simple_build/BUILD.gn format edits', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  const rootContent = await fs.readFile(rootPath, 'utf-8')
+  const content = 'foo=[ "a" ]\n' + rootContent + 'bar   =  1\n'
+  gn.update(rootPath, content)
+
+  const apply = (text: string, edits: gn.Edit[]) => {
+    const lines = text.split(/(?<=\n)/)
+    const reversed = [...edits].reverse()
+    reversed.forEach((edit) => {
+      lines.splice(edit.begin.line - 1, edit.end.line - edit.begin.line, edit.text)
+    })
+    return lines.join('')
+  }
+  const edits = gn.formatEdits(rootPath) ?? []
+  expect(edits.length).toBeGreaterThan(0)
+  expect(apply(content, edits)).toEqual(gn.format(rootPath))
+
+  const range = gn.formatEdits(rootPath, undefined, 1, 1) ?? []
+  expect(range).toEqual([{begin: {line: 1, column: 1}, end: {line: 2, column: 1}, text: 'foo = [ "a" ]\n'}])
+  expect(await gn.formatEditsAsync(rootPath, undefined, 1, 1)).toEqual(range)
+
+  gn.close(rootPath)
+})
+
+it('simple_build/BUILD.gn semantic tokens', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  gn.update(rootPath, 'executable("hello") {\n  deps = [ ":world" ]\n}\n')
+  gn.setInputVariables(['deps'], ['sources'])
+  try {
+    const full = await gn.semanticTokensAsync(rootPath)
+    expect(full && 'data' in full && Array.from(full.data)).toEqual([0, 0, 10, 1, 1, 1, 2, 4, 3, 0, 0, 9, 8, 4, 0])
+
+    gn.update(rootPath, [{begin: {line: 2, column: 12}, end: {line: 2, column: 12}, text: '"//:x", '}])
+    const delta = await gn.semanticTokensAsync(rootPath, full?.resultId)
+    expect(delta && 'edits' in delta && delta.edits.map((edit) => ({...edit, data: Array.from(edit.data)}))).toEqual([
+      {start: 12, deleteCount: 0, data: [6, 4, 0, 0, 8]},
+    ])
+    expect(await gn.semanticTokensAsync(rootPath, 'stale')).toHaveProperty('data')
+
+    // Columns count UTF-16 code units, also after other characters.
+    gn.update(rootPath, 'executable("é") { deps = [] }\n')
+    const wide = await gn.semanticTokensAsync(rootPath)
+    expect(wide && 'data' in wide && Array.from(wide.data)).toEqual([0, 0, 10, 1, 1, 0, 18, 4, 3, 0])
+  } finally {
+    gn.setInputVariables([], [])
+    gn.close(rootPath)
+  }
+})
+
+// Runs |test| on a project of |files| in a new directory, giving it a function
+// opening a file with its contents. The files opened are closed and the
+// directory removed afterwards, also when the test fails.
+async function withProject(
+  files: Record<string, string>,
+  test: (project: string, open: (file: string) => string) => Promise<void>,
+) {
+  const project = await fs.mkdtemp(path.join(os.tmpdir(), 'gnls-'))
+  const opened = new Set<string>()
+  const open = (file: string) => {
+    const absolute = path.join(project, file)
+    gn.update(absolute, files[file] ?? '')
+    opened.add(absolute)
+    return absolute
+  }
+  try {
+    for (const [file, content] of Object.entries(files)) {
+      await fs.mkdir(path.dirname(path.join(project, file)), {recursive: true})
+      await fs.writeFile(path.join(project, file), content)
+    }
+    await test(project, open)
+  } finally {
+    opened.forEach((file) => gn.close(file))
+    await fs.rm(project, {recursive: true, force: true})
+  }
+}
+
+// Where |location| is in |project|, as file:line:column.
+function projectLocation(project: string, location: gn.Location) {
+  return `${path.relative(project, location.file)}:${location.line.toString()}:${location.column.toString()}`
+}
+
+it('imports', async () => {
+  const files = {
+    '.gn': 'buildconfig = "//build/BUILDCONFIG.gn"\n',
+    'build/BUILDCONFIG.gn': 'import("//build/config.gni")\nis_foo = true\n',
+    'build/config.gni': 'import("templates.gni")\ndeclare_args() {\n  use_bar = false\n}\n_private = 1\n',
+    'build/templates.gni': 'template("foo_library") {\n}\n',
+    'BUILD.gn': 'import("//build/templates.gni")\n',
+  }
+  await withProject(files, async (project) => {
+    const imports = await gn.listImportsAsync(path.join(project, 'BUILD.gn'))
+    expect(imports.templates.map((it) => it.name)).toEqual(['foo_library'])
+    expect(imports.variables).toEqual(['is_foo', 'use_bar'])
+  })
+})
+
+it('definitions', async () => {
+  const files = {
+    '.gn': 'buildconfig = "//BUILDCONFIG.gn"\n',
+    'BUILDCONFIG.gn': 'enable_foo = true\n',
+    'BUILD.gn': [
+      '_common_sources = [ "a.cc" ]',
+      'if (enable_foo) {',
+      '  _common_sources += [ "foo.cc" ]',
+      '}',
+      'source_set("a") {',
+      '  _common_sources = []',
+      '  sources = _common_sources',
+      '}',
+      'foreach(x, []) {',
+      '  y = x',
+      '}',
+      'z = y + _common_sources',
+      '',
+    ].join('\n'),
+  }
+  await withProject(files, async (project, open) => {
+    const file = open('BUILD.gn')
+    const at = async (line: number, column: number) => {
+      const result = await gn.definitionAsync(file, line, column)
+      return result && projectLocation(project, result.range.begin)
+    }
+
+    // The innermost scope assigning the variable, then the file, then imports.
+    expect(await at(7, 13)).toEqual('BUILD.gn:6:3')
+    expect(await at(12, 9)).toEqual('BUILD.gn:1:1')
+    expect(await at(2, 5)).toEqual('BUILDCONFIG.gn:1:1')
+    // foreach() shares the scope it is in.
+    expect(await at(12, 5)).toEqual('BUILD.gn:10:3')
+    expect((await gn.definitionAsync(file, 7, 13))?.text).toEqual('_common_sources = []')
+    expect(await gn.definitionAsync(file, 10, 7)).toBeNull()
+  })
+})
+
+it('references', async () => {
+  const files = {
+    '.gn': 'buildconfig = "//BUILDCONFIG.gn"\n',
+    'BUILDCONFIG.gn': '',
+    'lib.gni': 'template("lib") {\n  foo = 1\n}\n',
+    'BUILD.gn': 'import("//lib.gni")\nlib("a") {\n  deps = [ "//b" ]\n}\n',
+    'b/BUILD.gn': 'lib("b") {\n  deps = [ ":c" ]\n}\nlib("c") {\n  foo = 2\n}\n',
+  }
+  await withProject(files, async (project, open) => {
+    // Opened so that they are indexed right away, rather than by the crawl.
+    for (const file of ['lib.gni', 'BUILD.gn', 'b/BUILD.gn']) {
+      open(file)
+    }
+    const at = async (file: string, line: number, column: number) => {
+      const result = await gn.referencesAsync(path.join(project, file), line, column)
+      const ranges = result?.ranges.map((it) => projectLocation(project, it.begin))
+      return {name: result?.name, ranges: ranges?.sort()}
+    }
+
+    expect(await at('BUILD.gn', 2, 1)).toEqual({
+      name: 'lib',
+      ranges: ['BUILD.gn:2:1', 'b/BUILD.gn:1:1', 'b/BUILD.gn:4:1', 'lib.gni:1:11'],
+    })
+    expect(await at('BUILD.gn', 3, 12)).toEqual({name: '//b:b', ranges: ['BUILD.gn:3:12', 'b/BUILD.gn:1:5']})
+    expect(await at('b/BUILD.gn', 4, 6)).toEqual({name: '//b:c', ranges: ['b/BUILD.gn:2:12', 'b/BUILD.gn:4:5']})
+    // A variable of the file stays in it, and builtins are left alone.
+    expect(await at('b/BUILD.gn', 5, 3)).toEqual({name: 'foo', ranges: ['b/BUILD.gn:5:3']})
+    expect(await at('BUILD.gn', 3, 3)).toEqual({name: undefined, ranges: undefined})
+    // Found by position, up to the end of the name.
+    expect((await at('BUILD.gn', 2, 3)).name).toEqual('lib')
+    expect((await at('BUILD.gn', 2, 4)).name).toBeUndefined()
+
+    // The index is shared by all tests, so only this project is looked at.
+    const search = (query: string) =>
+      gn
+        .searchSymbols(query, 1000)
+        .filter((it) => !path.relative(project, it.range.begin.file).startsWith('..'))
+        .map((it) => it.name)
+    expect(search('lib')).toEqual(['lib'])
+    expect(search('c')).toEqual(['c'])
+    expect(search('LIB')).toEqual(['lib'])
+    expect(search('xyz')).toEqual([])
+    expect(gn.searchSymbols('b', 1)).toHaveLength(1)
+
+    gn.update(path.join(project, 'b/BUILD.gn'), 'lib("b") {\n}\n')
+    expect((await at('BUILD.gn', 2, 1)).ranges).toEqual(['BUILD.gn:2:1', 'b/BUILD.gn:1:1', 'lib.gni:1:11'])
+    expect(search('c')).toEqual([])
+  })
+})
+
+it('dependencies', async () => {
+  const files = {
+    '.gn': 'buildconfig = "//BUILDCONFIG.gn"\n',
+    'BUILDCONFIG.gn': '',
+    'BUILD.gn': [
+      'group("a") {',
+      '  deps = [',
+      '    "//b",',
+      '    "//b:missing",',
+      '    "//b:b_tests",',
+      '    "//b:suite_tests",',
+      '    "//c",',
+      '  ]',
+      '}',
+      '',
+    ].join('\n'),
+    'b/BUILD.gn': [
+      'group("b") {',
+      '  if (true) {',
+      '    public_deps = [ "//:a" ]',
+      '  }',
+      '}',
+      'template("tests") {',
+      '}',
+      'tests("suite") {',
+      '}',
+      '',
+    ].join('\n'),
+  }
+  await withProject(files, async (project, open) => {
+    const file = open('BUILD.gn')
+    const check = async () =>
+      (await gn.checkDependenciesAsync(file)).map((it) => `${projectLocation(project, it.range.begin)} ${it.message}`)
+
+    // Only templates may declare more targets than they are named for.
+    expect(await check()).toEqual([
+      'BUILD.gn:4:5 Unresolved label //b:missing',
+      'BUILD.gn:5:5 Unresolved label //b:b_tests',
+      'BUILD.gn:7:5 Unresolved label //c:c',
+      'BUILD.gn:3:5 Dependency cycle: //:a -> //b:b -> //:a',
+    ])
+
+    // Only the edges of the changed file are made again.
+    gn.update(file, 'group("a") {\n  deps = [ "//b:missing" ]\n}\n')
+    expect(await check()).toEqual(['BUILD.gn:2:12 Unresolved label //b:missing'])
+  })
+})
+
+it('index cache', async () => {
+  await withProject({'BUILD.gn': 'group("cached") {\n}\n'}, async (project) => {
+    const cache = path.join(project, 'cache')
+    const file = path.join(project, 'BUILD.gn')
+    gn.setIndexCache(cache)
+    try {
+      expect((await gn.listLabelsAsync(project))?.map((it) => it.name)).toEqual(['cached'])
+      await gn.saveIndexAsync()
+      const saved = await fs.readFile(path.join(cache, 'index.cache'))
+      expect(saved.subarray(0, 4).toString()).toEqual('GNLS')
+
+      // As in a new session, reading the cache again, and counting the parses.
+      const reload = async () => {
+        gn.setIndexCache(cache)
+        gn.resetStats()
+        gn.invalidate(file)
+        const labels = (await gn.listLabelsAsync(project))?.map((it) => it.name)
+        return {labels, parses: gn.stats().phases.parse.count}
+      }
+      expect(await reload()).toEqual({labels: ['cached'], parses: 0})
+
+      // Touched without changes, found by the hash of the contents.
+      await gn.saveIndexAsync()
+      const later = new Date(Date.now() + 60 * 1000)
+      await fs.utimes(file, later, later)
+      expect(await reload()).toEqual({labels: ['cached'], parses: 0})
+
+      // Parsed again once changed, maybe also by the reload racing the lookup.
+      await gn.saveIndexAsync()
+      await fs.writeFile(file, 'group("changed") {\n}\n')
+      const changed = await reload()
+      expect(changed.labels).toEqual(['changed'])
+      expect(changed.parses).toBeGreaterThan(0)
+
+      // Another version of the format is not read.
+      await gn.saveIndexAsync()
+      const other = Buffer.from(await fs.readFile(path.join(cache, 'index.cache')))
+      other.writeUInt32LE(0xffffffff, 4)
+      await fs.writeFile(path.join(cache, 'index.cache'), other)
+      expect((await reload()).parses).toBeGreaterThan(0)
+    } finally {
+      gn.setIndexCache('')
+    }
+  })
+})
+
+it('directories', async () => {
+  await withProject({'a.cc': ''}, async (project) => {
+    await fs.mkdir(path.join(project, 'sub'))
+    expect(gn.listDirectory(project)).toEqual([
+      {name: 'a.cc', isDirectory: false},
+      {name: 'sub', isDirectory: true},
+    ])
+    expect(gn.listDirectory(project, true)).toEqual([{name: 'sub', isDirectory: true}])
+    expect(gn.listDirectory(path.join(project, 'sub'))).toEqual([])
+
+    // Listed again once changed, without the change being reported.
+    await fs.writeFile(path.join(project, 'sub', 'b.cc'), '')
+    expect(gn.listDirectory(path.join(project, 'sub'))).toEqual([{name: 'b.cc', isDirectory: false}])
+
+    await fs.rm(project, {recursive: true})
+    expect(gn.listDirectory(project)).toEqual([])
+  })
+})
+
+it('simple_build memory budget', async () => {
+  const files = ['BUILD.gn', 'build/BUILD.gn'].map((it) => `${root}/${it}`)
+  const contents = await Promise.all(files.map((file) => fs.readFile(file, 'utf-8')))
+  files.forEach((file, i) => gn.update(file, contents[i] ?? ''))
+  const treeBytes = (file: string) => gn.stats().documents.find((it) => it.file == file)?.treeBytes
+  const expected = gn.parse(files[0] ?? '')
+
+  gn.setMemoryBudget(0)
+  try {
+    expect(treeBytes(files[0] ?? '')).toEqual(0)
+    expect(treeBytes(files[1] ?? '')).toBeGreaterThan(0)
+    expect(gn.parse(files[0] ?? '')).toEqual(expected)
+    expect(treeBytes(files[1] ?? '')).toEqual(0)
+    gn.update(files[0] ?? '', [{begin: {line: 1, column: 1}, end: {line: 1, column: 1}, text: '\n'}])
+    expect(gn.validate(files[0] ?? '')).toBeNull()
+  } finally {
+    gn.setMemoryBudget(512 * 1024 * 1024)
+    files.forEach((file) => gn.close(file))
+  }
+})
+
+it('simple_build parseMany', async () => {
+  const files = ['BUILD.gn', 'build/BUILD.gn', 'build/toolchain/BUILD.gn', 'missing.gn'].map((it) => `${root}/${it}`)
+  const results = await gn.parseMany(files)
+  expect(results.length).toEqual(files.length)
+  for (const [i, file] of files.slice(0, 3).entries()) {
+    const content = await fs.readFile(file, 'utf-8')
+    expect(results[i]?.error).toBeNull()
+    expect(results[i]?.scope).toEqual(gn.parse(file, content))
+  }
+  expect(results[3]).toBeNull()
+})
+
+it('simple_build labels', async () => {
+  const rootPath = `${root}/BUILD.gn`
+  expect((await gn.lookupLabelAsync(root, 'hello'))?.function).toEqual('executable')
+  expect((await gn.listLabelsAsync(root))?.map((it) => it.name)).toContain('hello_shared')
+  expect(await gn.listLabelsAsync(`${root}/missing`)).toBeNull()
+
+  gn.update(rootPath, 'group("renamed") {\n}\n')
+  expect((await gn.lookupLabelAsync(root, 'renamed'))?.range.begin).toEqual({file: rootPath, line: 1, column: 1})
+  expect(await gn.lookupLabelAsync(root, 'hello')).toBeNull()
+
+  gn.close(rootPath)
+})
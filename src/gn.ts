@@ -17,6 +17,18 @@ export interface Range {
   end: Location
 }
 
+// Column is counted in UTF-16 code units, as in LSP.
+export interface Position {
+  line: number
+  column: number
+}
+
+export interface Edit {
+  begin: Position
+  end: Position
+  text: string
+}
+
 export interface Error {
   location: Location
   ranges: Range[]
@@ -36,6 +48,90 @@ export interface Scope {
   symbols: GNDocumentSymbol[]
 }
 
+// A label declared in a build file of the workspace. The function is the type of
+// target declared, also for target().
+export interface Declaration {
+  function: string
+  name: string
+  range: Range
+}
+
+// Compact forms, opted into by passing compact. A range is a quadruple of
+// begin line, begin column, end line and end column in an Int32Array, and a
+// string is an index into one string table.
+export interface CompactContext extends Omit<Context, 'token'> {
+  token?: {type: TokenType; value: string; range: Int32Array}
+}
+
+export interface CompactScope {
+  strings: string
+  offsets: Uint32Array
+  // The arguments of each declare follow its function name in the table.
+  declares: {names: Uint32Array; counts: Uint32Array; ranges: Int32Array}
+  // In preorder, with the index of the parent of each symbol or -1. Each
+  // symbol has its range then its selection range.
+  symbols: {kinds: Uint8Array; names: Uint32Array; parents: Int32Array; ranges: Int32Array}
+}
+
+export function getString(scope: CompactScope, index: number): string {
+  return scope.strings.substring(scope.offsets[index] ?? 0, scope.offsets[index + 1] ?? 0)
+}
+
+export function getCompactRange(ranges: Int32Array, index: number, file = ''): Range {
+  const at = (offset: number) => ranges[4 * index + offset] ?? 0
+  return {
+    begin: {file, line: at(0), column: at(1)},
+    end: {file, line: at(2), column: at(3)},
+  }
+}
+
+export interface ParseResult {
+  error: Error | null
+  scope: Scope
+}
+
+// Latencies in microseconds. Percentiles are upper bounds, from a histogram of
+// power of two buckets.
+export interface PhaseStats {
+  count: number
+  microseconds: number
+  p50: number
+  p90: number
+  p99: number
+  buckets: number[]
+}
+
+export type Phase = 'tokenize' | 'parse' | 'scope' | 'analyze' | 'format' | 'marshal'
+
+export interface Stats {
+  phases: Record<Phase, PhaseStats>
+  documents: {file: string; bytes: number; tokens: number; treeBytes: number}[]
+}
+
+// Tokens in the LSP encoding, or the edits to the previous result.
+export interface SemanticTokens {
+  resultId: string
+  data: Uint32Array
+}
+
+export interface SemanticTokensDelta {
+  resultId: string
+  edits: {start: number; deleteCount: number; data: Uint32Array}[]
+}
+
+// Problem found in a build file beyond its syntax.
+export interface Diagnostic {
+  range: Range
+  message: string
+}
+
+// Assignment defining a variable, with its line when in the same file.
+export interface Definition {
+  name: string
+  range: Range
+  text?: string
+}
+
 export interface Help {
   basic: string
   full: string
@@ -52,10 +148,106 @@ export interface GNDocumentSymbol {
 
 // eslint-disable-next-line @typescript-eslint/no-require-imports
 const addon = require(`../build/${os.platform()}-${os.arch()}.node`) as Record<string, unknown>
-export const update = addon.update as (file: string, content: string) => null
+export const update = addon.update as (file: string, content: string | Edit[]) => Error | null
 export const close = addon.close as (file: string) => null
 export const validate = addon.validate as (file: string) => Error | null
-export const analyze = addon.analyze as (file: string, line: number, column: number) => Context | null
-export const parse = addon.parse as (file: string, content?: string) => Scope | null
+export const analyze = addon.analyze as {
+  (file: string, line: number, column: number, content?: string): Context | null
+  (file: string, line: number, column: number, content: string | undefined, compact: true): CompactContext | null
+}
+export const parse = addon.parse as {
+  (file: string, content?: string): Scope | null
+  (file: string, content: string | undefined, compact: true): CompactScope | null
+}
 export const format = addon.format as (file: string, content?: string) => string | null
+// Edits formatting the file, or the top-level statements on lines first to last.
+export const formatEdits = addon.formatEdits as (
+  file: string,
+  content?: string,
+  first?: number,
+  last?: number,
+) => Edit[] | null
+export const catalog = addon.catalog as () => {
+  functions: Record<string, Omit<Help, 'full'>>
+  variables: Record<string, Omit<Help, 'full'>>
+}
 export const help = addon.help as (type: HelpType, name: string) => Help | null
+export const stats = addon.stats as () => Stats
+export const resetStats = addon.resetStats as () => null
+// Past this many bytes, the least recently used open documents keep only their
+// text until used again.
+export const setMemoryBudget = addon.setMemoryBudget as (bytes: number) => null
+export const setInputVariables = addon.setInputVariables as (labels: string[], paths: string[]) => null
+export const semanticTokensAsync = addon.semanticTokensAsync as (
+  file: string,
+  previousResultId?: string,
+) => Promise<SemanticTokens | SemanticTokensDelta | null>
+
+// Answered from an index of the build files under the roots of updated files.
+// Null when dir has no BUILD.gn.
+export const lookupLabelAsync = addon.lookupLabelAsync as (dir: string, name: string) => Promise<Declaration | null>
+export const listLabelsAsync = addon.listLabelsAsync as (dir: string) => Promise<Declaration[] | null>
+// Templates and variables from the files a file imports, and the build config.
+export const listImportsAsync = addon.listImportsAsync as (
+  file: string,
+) => Promise<{templates: Declaration[]; variables: string[]}>
+// Uses of the identifier or label at a position: across the workspace for
+// labels, templates and imported variables, else in its file alone. Null for
+// builtins. Labels are named source-absolute, like //base:base.
+export const referencesAsync = addon.referencesAsync as (
+  file: string,
+  line: number,
+  column: number,
+) => Promise<{name: string; ranges: Range[]} | null>
+// Declarations and top-level variables of the workspace best matching a query,
+// best first. Variables have an empty function.
+export const searchSymbols = addon.searchSymbols as (query: string, limit: number) => Declaration[]
+// Entries of a directory, cached until it is modified.
+export const listDirectory = addon.listDirectory as (
+  dir: string,
+  directoriesOnly?: boolean,
+) => {name: string; isDirectory: boolean}[]
+// Tells that a build file or a .gn file changed on disk.
+export const invalidate = addon.invalidate as (file: string) => null
+// Finds the project roots of the given directories ahead of time.
+export const seedRoots = addon.seedRoots as (dirs: string[]) => null
+// Keeps the index in a directory between sessions, so that files unchanged since
+// are not parsed again. An empty one keeps it nowhere.
+export const setIndexCache = addon.setIndexCache as (dir: string) => null
+// Saves the entries of the index changed since last time.
+export const saveIndexAsync = addon.saveIndexAsync as () => Promise<null>
+
+// Variants running on a worker thread. They see the document as updated by all
+// calls made before them.
+export const updateAsync = addon.updateAsync as (file: string, content: string | Edit[]) => Promise<Error | null>
+export const analyzeAsync = addon.analyzeAsync as {
+  (file: string, line: number, column: number, content?: string): Promise<Context | null>
+  (file: string, line: number, column: number, content: string | undefined, compact: true): Promise<CompactContext | null>
+}
+export const parseAsync = addon.parseAsync as {
+  (file: string, content?: string): Promise<Scope | null>
+  (file: string, content: string | undefined, compact: true): Promise<CompactScope | null>
+}
+// The assignment of the variable at a position in its scope, else in the files
+// it imports. Null when there is none.
+export const definitionAsync = addon.definitionAsync as (
+  file: string,
+  line: number,
+  column: number,
+  content?: string,
+) => Promise<Definition | null>
+// Changes when the targets or deps of an indexed file do, for the results of
+// checkDependenciesAsync to be stale. Updates of open files count once indexed,
+// which checkDependenciesAsync waits for.
+export const graphGeneration = addon.graphGeneration as () => number
+// Unresolved labels and dependency cycles in the deps of a build file, as indexed.
+export const checkDependenciesAsync = addon.checkDependenciesAsync as (file: string) => Promise<Diagnostic[]>
+export const formatAsync = addon.formatAsync as (file: string, content?: string) => Promise<string | null>
+export const formatEditsAsync = addon.formatEditsAsync as (
+  file: string,
+  content?: string,
+  first?: number,
+  last?: number,
+) => Promise<Edit[] | null>
+// Reads and parses files in parallel. Null for files that cannot be read.
+export const parseMany = addon.parseMany as (files: string[]) => Promise<(ParseResult | null)[]>
@@ -1,5 +1,5 @@
 import * as path from 'path'
-import {ExtensionContext} from 'vscode'
+import {ExtensionContext, workspace} from 'vscode'
 import {LanguageClient, TransportKind} from 'vscode-languageclient/node'
 
 let client: LanguageClient | undefined
@@ -20,6 +20,21 @@ export async function activate(context: ExtensionContext) {
     },
     {
       documentSelector: [{language: 'gn'}],
+      initializationOptions: {
+        memoryBudget: workspace.getConfiguration('gn').get<number>('memoryBudget'),
+        // Private to the extension and the workspace.
+        cacheDirectory: context.storageUri?.fsPath,
+      },
+      synchronize: {
+        configurationSection: 'gn',
+        fileEvents: [
+          // All the files indexed, including build configs, and the .gn files
+          // finding the roots. Listings for path completion check the times
+          // their directories were modified instead.
+          workspace.createFileSystemWatcher('**/*.{gn,gni}'),
+          workspace.createFileSystemWatcher('**/.gn'),
+        ],
+      },
     },
   )
   await client.start()
@@ -8,10 +8,48 @@ import * as gn from './gn'
 import * as data from './data'
 
 const connection = ls.createConnection(ls.ProposedFeatures.all)
-const documents = new ls.TextDocuments(lstd.TextDocument)
+const changes = new Map<string, lstd.TextDocumentContentChangeEvent[]>()
+const documents = new ls.TextDocuments({
+  create: lstd.TextDocument.create,
+  update: (document, events, version) => {
+    changes.set(document.uri, [...(changes.get(document.uri) ?? []), ...events])
+    return lstd.TextDocument.update(document, events, version)
+  },
+})
 const files = new Map<string, Set<string>>()
+// Syntax errors of open documents, by URI.
+const errors = new Map<string, gn.Error | null>()
+// Warnings about the deps of open documents as last checked, by URI, and the
+// ones to check again once typing pauses, first the one edited last.
+const warnings = new Map<string, ls.Diagnostic[]>()
+let pendingChecks = new Set<string>()
+let checkTimer: NodeJS.Timeout | undefined
+let graphGeneration = -1
+const checkDelay = 500
+// Enough for the editor to narrow down while typing.
+const maxWorkspaceSymbols = 256
+const indexSaveInterval = 5 * 60 * 1000
+
+// Sets the memory budget of open documents in MB, if set.
+function setMemoryBudget(megabytes?: number) {
+  if (megabytes) {
+    gn.setMemoryBudget(megabytes * 1024 * 1024)
+  }
+}
 
-connection.onInitialize(() => {
+connection.onInitialize((params) => {
+  const options = params.initializationOptions as {memoryBudget?: number; cacheDirectory?: string} | undefined
+  if (options?.cacheDirectory) {
+    // Ahead of the crawl, for it to start from the cache.
+    gn.setIndexCache(options.cacheDirectory)
+  }
+  gn.seedRoots(params.workspaceFolders?.map((folder) => URI.parse(folder.uri).fsPath) ?? [])
+  const inputs = data.targetVariables().filter((name) => data.variableDetail(name).isInput)
+  gn.setInputVariables(
+    inputs.filter((name) => data.variableDetail(name).isLabel),
+    inputs.filter((name) => !data.variableDetail(name).isLabel),
+  )
+  setMemoryBudget(options?.memoryBudget)
   return {
     capabilities: {
       textDocumentSync: ls.TextDocumentSyncKind.Incremental,
@@ -21,8 +59,20 @@ connection.onInitialize(() => {
       },
       hoverProvider: true,
       definitionProvider: true,
+      referencesProvider: true,
+      renameProvider: true,
+      workspaceSymbolProvider: true,
       documentFormattingProvider: true,
+      documentRangeFormattingProvider: true,
       documentSymbolProvider: true,
+      semanticTokensProvider: {
+        // In the order of the types and modifiers of the addon.
+        legend: {
+          tokenTypes: ['function', 'class', 'variable', 'property', 'label', 'path'],
+          tokenModifiers: ['defaultLibrary'],
+        },
+        full: {delta: true},
+      },
     },
   }
 })
@@ -33,17 +83,20 @@ documents.onDidChangeContent(async (event) => {
   const uris = files.get(file) ?? new Set()
   uris.add(uri)
   files.set(file, uris)
-  const content = event.document.getText()
-  gn.update(file, content)
-  await connection.sendDiagnostics({
-    uri: uri,
-    diagnostics: getDiagnostics(file),
-  })
+  const events = changes.get(uri) ?? []
+  changes.delete(uri)
+  const edits = uris.size == 1 ? getEdits(events) : undefined
+  errors.set(uri, await gn.updateAsync(file, edits ?? event.document.getText()))
+  await publishDiagnostics(uri)
+  scheduleChecks([uri])
 })
 
 documents.onDidClose(async (event) => {
   const uri = event.document.uri
   const file = URI.parse(uri).fsPath
+  changes.delete(uri)
+  errors.delete(uri)
+  warnings.delete(uri)
   const uris = files.get(file)
   if (uris) {
     uris.delete(uri)
@@ -58,6 +111,27 @@ documents.onDidClose(async (event) => {
   }
 })
 
+connection.languages.semanticTokens.on(async (params) => {
+  const file = URI.parse(params.textDocument.uri).fsPath
+  const result = await gn.semanticTokensAsync(file)
+  return result && 'data' in result ? {resultId: result.resultId, data: Array.from(result.data)} : {data: []}
+})
+
+connection.languages.semanticTokens.onDelta(async (params) => {
+  const file = URI.parse(params.textDocument.uri).fsPath
+  const result = await gn.semanticTokensAsync(file, params.previousResultId)
+  if (!result) {
+    return {data: []}
+  }
+  if ('data' in result) {
+    return {resultId: result.resultId, data: Array.from(result.data)}
+  }
+  return {
+    resultId: result.resultId,
+    edits: result.edits.map((edit) => ({...edit, data: Array.from(edit.data)})),
+  }
+})
+
 connection.onDocumentSymbol((params) => {
   const uri = params.textDocument.uri
   const file = URI.parse(uri).fsPath
@@ -88,16 +162,89 @@ connection.onDefinition((params) => {
   return getDefinition(file, line, column)
 })
 
+connection.onReferences(async (params) => {
+  const file = URI.parse(params.textDocument.uri).fsPath
+  const result = await gn.referencesAsync(file, params.position.line + 1, params.position.character + 1)
+  return result?.ranges.map((range) => ({uri: URI.file(range.begin.file).toString(), range: getRange(range)}))
+})
+
+connection.onRenameRequest(async (params) => {
+  const file = URI.parse(params.textDocument.uri).fsPath
+  const result = await gn.referencesAsync(file, params.position.line + 1, params.position.character + 1)
+  // Labels would need their directory part rewritten too, and builtins belong
+  // to GN.
+  if (!result || result.name.startsWith('//') || isBuiltin(result.name)) {
+    return null
+  }
+  const changes = {} as Record<string, ls.TextEdit[]>
+  result.ranges.forEach((range) => {
+    const uri = URI.file(range.begin.file).toString()
+    changes[uri] = [...(changes[uri] ?? []), {range: getRange(range), newText: params.newName}]
+  })
+  return {changes}
+})
+
+connection.onWorkspaceSymbol((params) => {
+  return gn.searchSymbols(params.query, maxWorkspaceSymbols).map((declaration) => ({
+    name: declaration.name,
+    kind: getSymbolKind(declaration.function),
+    location: {uri: URI.file(declaration.range.begin.file).toString(), range: getRange(declaration.range)},
+    containerName: declaration.function,
+  }))
+})
+
 connection.onDocumentFormatting((params) => {
   const uri = params.textDocument.uri
   const file = URI.parse(uri).fsPath
-  const document = documents.get(uri)
-  if (document) {
-    const lines = document.lineCount
-    return getFormatted(file, lines)
+  if (documents.get(uri)) {
+    return getFormatted(file)
   }
 })
 
+connection.onDocumentRangeFormatting((params) => {
+  const uri = params.textDocument.uri
+  const file = URI.parse(uri).fsPath
+  const {start, end} = params.range
+  if (documents.get(uri)) {
+    // A range ending at the start of a line leaves that line out.
+    const last = end.character == 0 && end.line > start.line ? end.line : end.line + 1
+    return getFormatted(file, start.line + 1, last)
+  }
+})
+
+// The settings of the gn section, sent again by the client when they change.
+connection.onDidChangeConfiguration((params) => {
+  const settings = params.settings as {gn?: {memoryBudget?: number}} | undefined
+  setMemoryBudget(settings?.gn?.memoryBudget)
+})
+
+connection.onDidChangeWatchedFiles((params) => {
+  params.changes.forEach((change) => gn.invalidate(URI.parse(change.uri).fsPath))
+})
+
+// Saves the index now and then, in case the server is killed.
+setInterval(() => {
+  void gn.saveIndexAsync()
+}, indexSaveInterval).unref()
+
+connection.onShutdown(async () => {
+  await gn.saveIndexAsync()
+})
+
+// Logs the stats of the addon every GNLS_STATS_INTERVAL milliseconds, if set.
+const statsInterval = Number(process.env.GNLS_STATS_INTERVAL ?? 0)
+if (statsInterval > 0) {
+  setInterval(() => {
+    const stats = gn.stats()
+    const phases = Object.entries(stats.phases)
+      .filter(([, phase]) => phase.count)
+      .map(([name, phase]) => `${name} ${phase.count}x p50<=${phase.p50}us p99<=${phase.p99}us`)
+    const bytes = stats.documents.reduce((total, document) => total + document.bytes + document.treeBytes, 0)
+    connection.console.log(`stats: ${phases.join(', ')}; ${stats.documents.length} documents, ~${bytes} bytes`)
+    gn.resetStats()
+  }, statsInterval)
+}
+
 documents.listen(connection)
 connection.listen()
 
@@ -108,6 +255,21 @@ function getPosition(location: gn.Location): ls.Position {
   }
 }
 
+function getSymbolKind(func: string): ls.SymbolKind {
+  if (!func) return ls.SymbolKind.Variable
+  if (func == 'template') return ls.SymbolKind.Function
+  return data.functionDetail(func).isTarget ? ls.SymbolKind.Class : ls.SymbolKind.Object
+}
+
+function isBuiltin(name: string): boolean {
+  return (
+    data.builtinFunctions().includes(name) ||
+    data.functionDetail(name).isTarget === true ||
+    data.variableDetail(name).isBuiltin === true ||
+    data.targetVariables().includes(name)
+  )
+}
+
 function getRange(range: gn.Range): ls.Range {
   return {
     start: getPosition(range.begin),
@@ -115,9 +277,66 @@ function getRange(range: gn.Range): ls.Range {
   }
 }
 
-function getDiagnostics(file: string): ls.Diagnostic[] {
+function getEdits(events: lstd.TextDocumentContentChangeEvent[]): gn.Edit[] | undefined {
+  const result = [] as gn.Edit[]
+  for (const event of events) {
+    if (!('range' in event)) return undefined
+    result.push({
+      begin: {line: event.range.start.line + 1, column: event.range.start.character + 1},
+      end: {line: event.range.end.line + 1, column: event.range.end.character + 1},
+      text: event.text,
+    })
+  }
+  return result.length ? result : undefined
+}
+
+async function publishDiagnostics(uri: string) {
+  if (!documents.get(uri)) return
+  await connection.sendDiagnostics({
+    uri: uri,
+    diagnostics: [...getDiagnostics(errors.get(uri) ?? null), ...(warnings.get(uri) ?? [])],
+  })
+}
+
+// Checks the deps of |uris| once typing pauses, each walking the graph of
+// targets, so that they do not queue up behind every keystroke.
+function scheduleChecks(uris: string[]) {
+  pendingChecks = new Set([...uris, ...pendingChecks])
+  clearTimeout(checkTimer)
+  checkTimer = setTimeout(() => void runChecks(), checkDelay)
+}
+
+async function runChecks() {
+  const queue = [...pendingChecks]
+  const checked = new Set<string>()
+  pendingChecks = new Set()
+  // One at a time, leaving the thread pool to updates.
+  for (let uri = queue.shift(); uri !== undefined; uri = queue.shift()) {
+    if (checked.has(uri) || !documents.get(uri)) continue
+    checked.add(uri)
+    const dependencies = await gn.checkDependenciesAsync(URI.parse(uri).fsPath)
+    warnings.set(
+      uri,
+      dependencies.map((diagnostic) => ({
+        range: getRange(diagnostic.range),
+        severity: ls.DiagnosticSeverity.Warning,
+        source: 'gnls',
+        message: diagnostic.message,
+      })),
+    )
+    await publishDiagnostics(uri)
+    // Checking brings the index up to date with the edits. When their targets
+    // changed, they may resolve or break the deps of the others.
+    const generation = gn.graphGeneration()
+    if (generation != graphGeneration) {
+      graphGeneration = generation
+      queue.push(...documents.keys().filter((other) => !checked.has(other)))
+    }
+  }
+}
+
+function getDiagnostics(error: gn.Error | null): ls.Diagnostic[] {
   const result = [] as ls.Diagnostic[]
-  const error = gn.validate(file)
   if (error) {
     result.push({
       range: getRange(
@@ -134,9 +353,43 @@ function getDiagnostics(file: string): ls.Diagnostic[] {
   return result
 }
 
+// Completion items of the builtin names, built once from the catalog of the
+// addon, and lists of them by context.
+const completionItems = new Map<string, ls.CompletionItem>()
+const completionLists = new Map<string, ls.CompletionItem[]>()
+
+function getCompletionList(key: string, build: () => ls.CompletionItem[]): ls.CompletionItem[] {
+  let result = completionLists.get(key)
+  if (!result) {
+    result = build()
+    completionLists.set(key, result)
+  }
+  return result
+}
+
 function getFunctionCompletion(name: string): ls.CompletionItem {
+  const key = `function:${name}`
+  let result = completionItems.get(key)
+  if (!result) {
+    result = makeFunctionCompletion(name)
+    completionItems.set(key, result)
+  }
+  return result
+}
+
+function getVariableCompletion(name: string): ls.CompletionItem {
+  const key = `variable:${name}`
+  let result = completionItems.get(key)
+  if (!result) {
+    result = makeVariableCompletion(name)
+    completionItems.set(key, result)
+  }
+  return result
+}
+
+function makeFunctionCompletion(name: string): ls.CompletionItem {
   const detail = data.functionDetail(name)
-  const help = gn.help('function', name)
+  const help = gn.catalog().functions[name]
   const result = {
     label: name,
     kind: detail.isTarget ? ls.CompletionItemKind.Class : ls.CompletionItemKind.Function,
@@ -151,9 +404,9 @@ function getFunctionCompletion(name: string): ls.CompletionItem {
   return result
 }
 
-function getVariableCompletion(name: string): ls.CompletionItem {
+function makeVariableCompletion(name: string): ls.CompletionItem {
   const detail = data.variableDetail(name)
-  const help = gn.help('variable', name)
+  const help = gn.catalog().variables[name]
   const result = {
     label: name,
     kind: detail.isBuiltin ? ls.CompletionItemKind.Variable : ls.CompletionItemKind.Field,
@@ -176,13 +429,22 @@ function getFileCompletion(name: string): ls.CompletionItem {
   return {label: name, kind: ls.CompletionItemKind.File}
 }
 
+function getTemplateCompletion(declaration: gn.Declaration, root?: string): ls.CompletionItem {
+  const file = declaration.range.begin.file
+  return {
+    label: declaration.name,
+    kind: ls.CompletionItemKind.Class,
+    detail: `template in ${root ? `//${path.relative(root, file)}` : file}`,
+  }
+}
+
 function getLabelCompletion(name: string): ls.CompletionItem {
   return {label: name, kind: ls.CompletionItemKind.Constant}
 }
 
-function getCompletions(file: string, line: number, column: number): ls.CompletionItem[] {
+async function getCompletions(file: string, line: number, column: number): Promise<ls.CompletionItem[]> {
   const result = [] as ls.CompletionItem[]
-  const context = gn.analyze(file, line, column)
+  const context = await gn.analyzeAsync(file, line, column)
   switch (context?.token?.type) {
     case 'literal': {
       const detail = data.variableDetail(context.variable)
@@ -197,28 +459,16 @@ function getCompletions(file: string, line: number, column: number): ls.Completi
           try {
             if (colon) {
               if (detail.isLabel) {
-                const filepath = path.join(absolute, 'BUILD.gn')
-                const content = fs.readFileSync(filepath, {encoding: 'utf8'})
-                const scope = gn.parse(filepath, content)
-                scope?.declares.forEach((declare) => {
-                  const func = declare.function
-                  const arg0 = (declare.arguments[0] ?? '').replace(/^"|"$/g, '')
-                  const arg1 = (declare.arguments[1] ?? '').replace(/^"|"$/g, '')
-                  const target = func == 'target' ? arg0 : func
-                  const label = func == 'target' ? arg1 : arg0
-                  if (data.functionDetail(target).isTarget && label) {
-                    result.push(getLabelCompletion(label))
+                const declarations = await gn.listLabelsAsync(absolute)
+                declarations?.forEach((declaration) => {
+                  if (data.functionDetail(declaration.function).isTarget) {
+                    result.push(getLabelCompletion(declaration.name))
                   }
                 })
               }
             } else {
-              const entries = fs.readdirSync(absolute, {withFileTypes: true})
-              entries.forEach((entry) => {
-                if (entry.isDirectory()) {
-                  result.push(getDirectoryCompletion(entry.name))
-                } else if (!detail.isLabel) {
-                  result.push(getFileCompletion(entry.name))
-                }
+              gn.listDirectory(absolute, detail.isLabel).forEach((entry) => {
+                result.push(entry.isDirectory ? getDirectoryCompletion(entry.name) : getFileCompletion(entry.name))
               })
             }
           } catch {
@@ -229,19 +479,26 @@ function getCompletions(file: string, line: number, column: number): ls.Completi
       break
     }
     default: {
-      result.push(...data.builtinFunctions().map(getFunctionCompletion))
-      result.push(...data.builtinVariables().map(getVariableCompletion))
+      result.push(...getCompletionList('builtin', () => [
+        ...data.builtinFunctions().map(getFunctionCompletion),
+        ...data.builtinVariables().map(getVariableCompletion),
+      ]))
+      const imports = await gn.listImportsAsync(file)
+      result.push(...imports.templates.map((declaration) => getTemplateCompletion(declaration, context?.root)))
+      result.push(...imports.variables.map((name) => ({label: name, kind: ls.CompletionItemKind.Variable})))
       if (context?.function) {
         const func = context.function.name
         const arg0 = (context.function.arguments[0] ?? '').replace(/^"|"$/g, '')
         const target = func == 'target' ? arg0 : func
         if (func == 'template') {
-          result.push(...data.targetFunctions().map(getFunctionCompletion))
+          result.push(...getCompletionList('targets', () => data.targetFunctions().map(getFunctionCompletion)))
         } else {
-          result.push(...data.targetVariables(target).map(getVariableCompletion))
+          result.push(
+            ...getCompletionList(`target:${target}`, () => data.targetVariables(target).map(getVariableCompletion)),
+          )
         }
       } else {
-        result.push(...data.targetFunctions().map(getFunctionCompletion))
+        result.push(...getCompletionList('targets', () => data.targetFunctions().map(getFunctionCompletion)))
       }
       break
     }
@@ -249,8 +506,8 @@ function getCompletions(file: string, line: number, column: number): ls.Completi
   return result
 }
 
-function getHover(file: string, line: number, column: number): ls.Hover | undefined {
-  const context = gn.analyze(file, line, column)
+async function getHover(file: string, line: number, column: number): Promise<ls.Hover | undefined> {
+  const context = await gn.analyzeAsync(file, line, column)
   switch (context?.token?.type) {
     case 'identifier': {
       const help = gn.help('all', context.token.value)
@@ -263,14 +520,29 @@ function getHover(file: string, line: number, column: number): ls.Hover | undefi
           range: getRange(context.token.range),
         }
       }
+      // Else a variable of the workspace, shown as assigned.
+      const definition = await gn.definitionAsync(file, line, column)
+      if (definition) {
+        const {file: defined, line: at} = definition.range.begin
+        const source = context.root ? `//${path.relative(context.root, defined)}` : defined
+        const link = `${URI.file(defined).toString()}#L${at.toString()}`
+        const value =
+          definition.text !== undefined
+            ? ['```gn', definition.text, '```'].join('\n')
+            : `\`${definition.name}\` is declared in [${source}](${link})`
+        return {
+          contents: {kind: 'markdown', value},
+          range: getRange(context.token.range),
+        }
+      }
       break
     }
   }
 }
 
-function getDefinition(file: string, line: number, column: number): ls.DefinitionLink[] {
+async function getDefinition(file: string, line: number, column: number): Promise<ls.DefinitionLink[]> {
   const result = [] as ls.DefinitionLink[]
-  const context = gn.analyze(file, line, column)
+  const context = await gn.analyzeAsync(file, line, column)
   switch (context?.token?.type) {
     case 'literal': {
       if (context.token.value.startsWith('"')) {
@@ -301,16 +573,10 @@ function getDefinition(file: string, line: number, column: number): ls.Definitio
           } else if (entry.isDirectory()) {
             const filepath = path.join(absolute, 'BUILD.gn')
             const target = colon ? parts[1] : path.basename(absolute)
-            const content = fs.readFileSync(filepath, {encoding: 'utf8'})
-            const scope = gn.parse(filepath, content)
-            const declare = scope?.declares.find((declare) => {
-              const func = declare.function
-              const arg0 = (declare.arguments[0] ?? '').replace(/^"|"$/g, '')
-              const arg1 = (declare.arguments[1] ?? '').replace(/^"|"$/g, '')
-              const label = func == 'target' ? arg1 : arg0
-              return label == target
-            })
-            result.push(linkWithRange(filepath, declare ? getRange(declare.range) : undefined))
+            const declaration = await gn.lookupLabelAsync(absolute, target)
+            if (declaration || fs.existsSync(filepath)) {
+              result.push(linkWithRange(filepath, declaration ? getRange(declaration.range) : undefined))
+            }
           }
         } catch {
           // continue
@@ -318,38 +584,56 @@ function getDefinition(file: string, line: number, column: number): ls.Definitio
       }
       break
     }
+    case 'identifier': {
+      const definition = await gn.definitionAsync(file, line, column)
+      if (definition) {
+        result.push({
+          originSelectionRange: getRange(context.token.range),
+          targetUri: URI.file(definition.range.begin.file).toString(),
+          targetRange: getRange(definition.range),
+          targetSelectionRange: getRange(definition.range),
+        })
+      }
+      break
+    }
   }
   return result
 }
 
-function getFormatted(file: string, lines: number): ls.TextEdit[] {
-  const result = [] as ls.TextEdit[]
-  const code = gn.format(file)
-  if (code) {
-    result.push({
-      newText: code,
-      range: {
-        start: {line: 0, character: 0},
-        end: {line: lines, character: 0},
-      },
-    })
-  }
-  return result
+async function getFormatted(file: string, first?: number, last?: number): Promise<ls.TextEdit[]> {
+  const edits = await gn.formatEditsAsync(file, undefined, first, last)
+  return (edits ?? []).map((edit) => ({
+    newText: edit.text,
+    range: {
+      start: {line: edit.begin.line - 1, character: edit.begin.column - 1},
+      end: {line: edit.end.line - 1, character: edit.end.column - 1},
+    },
+  }))
 }
 
-function getDocumentSymbol(file: string): ls.DocumentSymbol[] {
-  const mapToDocumentSymbol = (symbol: gn.GNDocumentSymbol): ls.DocumentSymbol => {
-    const result: ls.DocumentSymbol = {
-      name: symbol.name,
-      kind: symbol.kind,
-      range: getRange(symbol.range),
-      selectionRange: getRange(symbol.range),
-    }
-    if (symbol.children) {
-      result.children = symbol.children.map(mapToDocumentSymbol)
-    }
-    return result
+async function getDocumentSymbol(file: string): Promise<ls.DocumentSymbol[]> {
+  const result = [] as ls.DocumentSymbol[]
+  const scope = await gn.parseAsync(file, undefined, true)
+  if (scope) {
+    const {kinds, names, parents, ranges} = scope.symbols
+    const symbols = [] as ls.DocumentSymbol[]
+    kinds.forEach((kind, i) => {
+      const range = getRange(gn.getCompactRange(ranges, 2 * i))
+      const symbol: ls.DocumentSymbol = {
+        name: gn.getString(scope, names[i] ?? 0),
+        kind: kind as ls.SymbolKind,
+        range: range,
+        selectionRange: range,
+      }
+      const parent = symbols[parents[i] ?? -1]
+      if (parent) {
+        parent.children ??= []
+        parent.children.push(symbol)
+      } else {
+        result.push(symbol)
+      }
+      symbols.push(symbol)
+    })
   }
-  const symbols = gn.parse(file)?.symbols ?? []
-  return symbols.map(mapToDocumentSymbol)
+  return result
 }